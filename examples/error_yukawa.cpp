@@ -0,0 +1,112 @@
+/** @file error_yukawa.cpp
+ * @brief Compare the speed and accuracy of the Cartesian and spherical
+ * Yukawa expansions by running an instance of the kernel matrix-vector
+ * product with each and yielding statistics.
+ */
+
+#include "fmmtl/KernelMatrix.hpp"
+#include "fmmtl/Direct.hpp"
+#include "fmmtl/util/Clock.hpp"
+
+#include "YukawaCartesian.hpp"
+#include "YukawaSpherical.hpp"
+
+
+/** Execute the FMM of K and compare the result to exact, if not empty */
+template <typename Kernel, typename Source, typename Charge, typename Result>
+void run(const char* name, const Kernel& K, const FMMOptions& opts,
+         const std::vector<Source>& points,
+         const std::vector<Charge>& charges,
+         const std::vector<Result>& exact) {
+  // Build the FMM
+  fmmtl::kernel_matrix<Kernel> A = K(points, points);
+  A.set_options(opts);
+
+  // Execute the FMM, the first product also builds the translation caches
+  Clock t1;
+  std::vector<Result> result = A * charges;
+  double time1 = t1.seconds();
+
+  Clock t2;
+  result = A * charges;
+  double time2 = t2.seconds();
+  std::cout << name << ": FMM in " << time1 << " secs, "
+            << time2 << " secs" << std::endl;
+
+  // Check the result
+  if (exact.empty())
+    return;
+
+  double tot_error_sq = 0;
+  double tot_norm_sq = 0;
+  double max_ind_rel_err = 0;
+  for (unsigned k = 0; k < result.size(); ++k) {
+    // Maximum relative error
+    double rel_error = norm_2(exact[k] - result[k]) / norm_2(exact[k]);
+    max_ind_rel_err  = std::max(max_ind_rel_err, rel_error);
+
+    // Total relative error
+    tot_error_sq += norm_2_sq(exact[k] - result[k]);
+    tot_norm_sq  += norm_2_sq(exact[k]);
+  }
+  double tot_rel_err = sqrt(tot_error_sq/tot_norm_sq);
+  std::cout << name << ": Vector  relative error: " << tot_rel_err
+            << std::endl;
+  std::cout << name << ": Maximum relative error: " << max_ind_rel_err
+            << std::endl;
+}
+
+
+int main(int argc, char **argv)
+{
+  int N = 10000;
+  int P_cart = 6;
+  int P_sph = 10;
+  double kappa = 1;
+  bool checkErrors = true;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      N = atoi(argv[++i]);
+    } else if (strcmp(argv[i],"-Pcart") == 0) {
+      P_cart = atoi(argv[++i]);
+    } else if (strcmp(argv[i],"-Psph") == 0) {
+      P_sph = atoi(argv[++i]);
+    } else if (strcmp(argv[i],"-kappa") == 0) {
+      kappa = atof(argv[++i]);
+    } else if (strcmp(argv[i],"-nocheck") == 0) {
+      checkErrors = false;
+    }
+  }
+
+  // Init the FMM Kernel and options
+  FMMOptions opts = get_options(argc, argv);
+
+  // Init kernels
+  YukawaCartesian Kc(P_cart, kappa);
+  YukawaSpherical Ks(P_sph, kappa);
+
+  typedef YukawaSpherical::source_type source_type;
+  typedef YukawaSpherical::charge_type charge_type;
+  typedef YukawaSpherical::result_type result_type;
+
+  // Init points and charges
+  std::vector<source_type> points = fmmtl::random_n(N);
+
+  std::vector<charge_type> charges = fmmtl::random_n(N);
+
+  std::vector<result_type> exact;
+  if (checkErrors) {
+    std::cout << "Computing direct matvec..." << std::endl;
+    exact.resize(N);
+
+    // Compute the result with a direct matrix-vector multiplication
+    { ScopeClock timer("Direct in ");
+    fmmtl::direct(Ks, points, charges, exact);
+    }
+  }
+
+  run("YukawaCartesian", Kc, opts, points, charges, exact);
+  run("YukawaSpherical", Ks, opts, points, charges, exact);
+}
@@ -0,0 +1,91 @@
+/** @file laplace_order.cpp
+ * @brief Compare the spherical Laplace expansions with a runtime order,
+ * LaplaceSpherical, and a compile-time order, LaplaceSphericalP<P>, for
+ * the orders P = 4..16.
+ */
+
+#include "fmmtl/KernelMatrix.hpp"
+#include "fmmtl/util/Clock.hpp"
+
+#include "LaplaceSpherical.hpp"
+#include "LaplaceSphericalP.hpp"
+
+template <typename Expansion, typename Source, typename Charge,
+          typename Result>
+double time_matvec(const Expansion& K, const FMMOptions& opts,
+                   const std::vector<Source>& points,
+                   const std::vector<Charge>& charges,
+                   std::vector<Result>& result) {
+  fmmtl::kernel_matrix<Expansion> A = K(points, points);
+  A.set_options(opts);
+
+  // Warm up: builds the plan and the translation tables
+  result = A * charges;
+
+  const unsigned ITER = 3;
+  Clock clock;
+  for (unsigned iter = 0; iter < ITER; ++iter)
+    result = A * charges;
+  return clock.seconds() / ITER;
+}
+
+template <int P, int P_LAST>
+struct CompareOrders {
+  template <typename Source, typename Charge>
+  static void run(const FMMOptions& opts,
+                  const std::vector<Source>& points,
+                  const std::vector<Charge>& charges) {
+    typedef LaplaceSpherical::result_type result_type;
+    std::vector<result_type> r_dyn, r_fix;
+
+    double t_dyn = time_matvec(LaplaceSpherical(P), opts,
+                               points, charges, r_dyn);
+    double t_fix = time_matvec(LaplaceSphericalP<P>(), opts,
+                               points, charges, r_fix);
+
+    // The two should agree to round-off
+    double diff_sq = 0, norm_sq = 0;
+    for (unsigned k = 0; k < r_dyn.size(); ++k) {
+      diff_sq += norm_2_sq(r_fix[k] - r_dyn[k]);
+      norm_sq += norm_2_sq(r_dyn[k]);
+    }
+
+    std::cout << P << "\t" << t_dyn << "\t" << t_fix << "\t"
+              << t_dyn / t_fix << "\t" << std::sqrt(diff_sq / norm_sq)
+              << std::endl;
+
+    CompareOrders<P+1, P_LAST>::run(opts, points, charges);
+  }
+};
+
+template <int P_LAST>
+struct CompareOrders<P_LAST+1, P_LAST> {
+  template <typename... Args>
+  static void run(Args&&...) {}
+};
+
+
+int main(int argc, char** argv) {
+  int N = 100000;
+
+  // Parse custom command line args
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i],"-N") == 0) {
+      N = atoi(argv[++i]);
+    }
+  }
+
+  FMMOptions opts = get_options(argc, argv);
+
+  typedef LaplaceSpherical::source_type source_type;
+  typedef LaplaceSpherical::charge_type charge_type;
+
+  std::vector<source_type> points = fmmtl::random_n(N);
+  std::vector<charge_type> charges = fmmtl::random_n(N);
+
+  std::cout << "P\tLaplaceSpherical\tLaplaceSphericalP\tspeedup\tdiff"
+            << std::endl;
+  CompareOrders<4, 16>::run(opts, points, charges);
+
+  return 0;
+}
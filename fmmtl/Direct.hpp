@@ -1,15 +1,234 @@
 #pragma once
 /** @file Direct.hpp
  * @brief Dispatch methods for direct matrix evaluation
+ *
+ * Over random-access ranges the direct matvecs are tiled into blocks of
+ * P2P_BLOCK_SIZE bodies and parallelized over the tiles with OpenMP.
+ * Other ranges are evaluated serially with the S2T block evaluators.
  */
 
+#include <algorithm>
+#include <iterator>
 #include <type_traits>
+#include <vector>
 
 #include <boost/range/has_range_iterator.hpp>
 
+#include "fmmtl/config.hpp"
 #include "fmmtl/dispatch/S2T.hpp"
 
 namespace fmmtl {
+namespace detail {
+
+/** True if all of the iterators are random-access */
+template <typename... Iters>
+struct all_random_access;
+
+template <>
+struct all_random_access<> {
+  static const bool value = true;
+};
+
+template <typename Iter, typename... Iters>
+struct all_random_access<Iter, Iters...> {
+  static const bool value =
+      std::is_base_of<std::random_access_iterator_tag,
+                      typename std::iterator_traits<Iter>::iterator_category
+                      >::value &&
+      all_random_access<Iters...>::value;
+};
+
+/** Asymmetric matvec, serial fallback */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline
+typename std::enable_if<!all_random_access<SourceIter, ChargeIter,
+                                           TargetIter, ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+             TargetIter t_first, TargetIter t_last, ResultIter r_first)
+{
+  block_eval(K, s_first, s_last, c_first, t_first, t_last, r_first);
+}
+
+/** Asymmetric matvec. Each thread owns tiles of targets and sweeps the
+ * sources one tile at a time, so no result is written by two threads.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline
+typename std::enable_if<all_random_access<SourceIter, ChargeIter,
+                                          TargetIter, ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+             TargetIter t_first, TargetIter t_last, ResultIter r_first)
+{
+  const std::ptrdiff_t B = P2P_BLOCK_SIZE;
+  const std::ptrdiff_t num_sources = s_last - s_first;
+  const std::ptrdiff_t num_targets = t_last - t_first;
+
+#pragma omp parallel for schedule(dynamic)
+  for (std::ptrdiff_t i = 0; i < num_targets; i += B) {
+    const std::ptrdiff_t i_end = std::min(i + B, num_targets);
+    for (std::ptrdiff_t j = 0; j < num_sources; j += B) {
+      const std::ptrdiff_t j_end = std::min(j + B, num_sources);
+      block_eval(K,
+                 s_first + j, s_first + j_end, c_first + j,
+                 t_first + i, t_first + i_end, r_first + i);
+    }
+  }
+}
+
+/** Symmetric matvec, off-diagonal block, serial fallback */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter, typename ResultIter>
+inline
+typename std::enable_if<!all_random_access<SourceIter, ChargeIter,
+                                           ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter p1_first, SourceIter p1_last,
+             ChargeIter c1_first, ResultIter r1_first,
+             SourceIter p2_first, SourceIter p2_last,
+             ChargeIter c2_first, ResultIter r2_first)
+{
+  block_eval(K,
+             p1_first, p1_last, c1_first, r1_first,
+             p2_first, p2_last, c2_first, r2_first);
+}
+
+/** Symmetric matvec, off-diagonal block.
+ * Each thread owns tiles of the first block and adds their results once
+ * per tile. The results of the second block are summed into a per-thread
+ * accumulator and reduced at the end.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter, typename ResultIter>
+inline
+typename std::enable_if<all_random_access<SourceIter, ChargeIter,
+                                          ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter p1_first, SourceIter p1_last,
+             ChargeIter c1_first, ResultIter r1_first,
+             SourceIter p2_first, SourceIter p2_last,
+             ChargeIter c2_first, ResultIter r2_first)
+{
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  const std::ptrdiff_t B = P2P_BLOCK_SIZE;
+  const std::ptrdiff_t n1 = p1_last - p1_first;
+  const std::ptrdiff_t n2 = p2_last - p2_first;
+
+  std::vector<std::vector<result_type> > acc(omp_get_max_threads());
+
+#pragma omp parallel
+  {
+    std::vector<result_type>& r2 = acc[omp_get_thread_num()];
+    r2.assign(n2, result_type(0));
+    std::vector<result_type> r1(B);
+
+#pragma omp for schedule(dynamic)
+    for (std::ptrdiff_t i = 0; i < n1; i += B) {
+      const std::ptrdiff_t i_end = std::min(i + B, n1);
+      std::fill(r1.begin(), r1.end(), result_type(0));
+      for (std::ptrdiff_t j = 0; j < n2; j += B) {
+        const std::ptrdiff_t j_end = std::min(j + B, n2);
+        block_eval(K,
+                   p1_first + i, p1_first + i_end, c1_first + i, r1.begin(),
+                   p2_first + j, p2_first + j_end, c2_first + j,
+                   r2.begin() + j);
+      }
+      for (std::ptrdiff_t k = i; k < i_end; ++k)
+        r1_first[k] += r1[k - i];
+    }
+
+    // Reduce the accumulators into the results
+#pragma omp for
+    for (std::ptrdiff_t k = 0; k < n2; ++k)
+      for (auto&& a : acc)
+        if (!a.empty())
+          r2_first[k] += a[k];
+  }
+}
+
+/** Symmetric matvec, diagonal block, serial fallback */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter, typename ResultIter>
+inline
+typename std::enable_if<!all_random_access<SourceIter, ChargeIter,
+                                           ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter p_first, SourceIter p_last,
+             ChargeIter c_first, ResultIter r_first)
+{
+  block_eval(K, p_first, p_last, c_first, r_first);
+}
+
+/** Symmetric matvec, diagonal block.
+ * The tiles (i,j) with i <= j are distributed by rows of tiles. A row
+ * writes to the results of every tile it touches, so each thread sums
+ * into its own accumulator and the accumulators are reduced at the end.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter, typename ResultIter>
+inline
+typename std::enable_if<all_random_access<SourceIter, ChargeIter,
+                                          ResultIter>::value>::type
+direct_tiled(const Kernel& K,
+             SourceIter p_first, SourceIter p_last,
+             ChargeIter c_first, ResultIter r_first)
+{
+  typedef typename std::iterator_traits<ResultIter>::value_type result_type;
+
+  const std::ptrdiff_t B = P2P_BLOCK_SIZE;
+  const std::ptrdiff_t n = p_last - p_first;
+
+  if (n <= B || omp_get_max_threads() == 1) {
+    for (std::ptrdiff_t i = 0; i < n; i += B) {
+      const std::ptrdiff_t i_end = std::min(i + B, n);
+      block_eval(K, p_first + i, p_first + i_end, c_first + i, r_first + i);
+      for (std::ptrdiff_t j = i_end; j < n; j += B) {
+        const std::ptrdiff_t j_end = std::min(j + B, n);
+        block_eval(K,
+                   p_first + i, p_first + i_end, c_first + i, r_first + i,
+                   p_first + j, p_first + j_end, c_first + j, r_first + j);
+      }
+    }
+    return;
+  }
+
+  std::vector<std::vector<result_type> > acc(omp_get_max_threads());
+
+#pragma omp parallel
+  {
+    std::vector<result_type>& r = acc[omp_get_thread_num()];
+    r.assign(n, result_type(0));
+
+    // The rows of tiles shrink with i, so hand them out dynamically
+#pragma omp for schedule(dynamic)
+    for (std::ptrdiff_t i = 0; i < n; i += B) {
+      const std::ptrdiff_t i_end = std::min(i + B, n);
+      block_eval(K, p_first + i, p_first + i_end, c_first + i, r.begin() + i);
+      for (std::ptrdiff_t j = i_end; j < n; j += B) {
+        const std::ptrdiff_t j_end = std::min(j + B, n);
+        block_eval(K,
+                   p_first + i, p_first + i_end, c_first + i, r.begin() + i,
+                   p_first + j, p_first + j_end, c_first + j, r.begin() + j);
+      }
+    }
+
+    // Reduce the accumulators into the results
+#pragma omp for
+    for (std::ptrdiff_t k = 0; k < n; ++k)
+      for (auto&& a : acc)
+        if (!a.empty())
+          r_first[k] += a[k];
+  }
+}
+
+} // end namespace detail
+
 
 /** Asymmetric matvec
  */
@@ -23,9 +242,9 @@ direct(const Kernel& K,
        TargetIter t_first, TargetIter t_last,
        ResultIter r_first)
 {
-  detail::block_eval(K,
-                     s_first, s_last, c_first,
-                     t_first, t_last, r_first);
+  detail::direct_tiled(K,
+                       s_first, s_last, c_first,
+                       t_first, t_last, r_first);
 }
 
 /** Symmetric matvec, off-diagonal block
@@ -39,9 +258,9 @@ direct(const Kernel& K,
        SourceIter p2_first, SourceIter p2_last,
        ChargeIter c2_first, ResultIter r2_first)
 {
-  detail::block_eval(K,
-                     p1_first, p1_last, c1_first, r1_first,
-                     p2_first, p2_last, c2_first, r2_first);
+  detail::direct_tiled(K,
+                       p1_first, p1_last, c1_first, r1_first,
+                       p2_first, p2_last, c2_first, r2_first);
 }
 
 /** Symmetric matvec, diagonal block
@@ -54,8 +273,8 @@ direct(const Kernel& K,
        SourceIter p_first, SourceIter p_last,
        ChargeIter c_first, ResultIter r_first)
 {
-  detail::block_eval(K,
-                     p_first, p_last, c_first, r_first);
+  detail::direct_tiled(K,
+                       p_first, p_last, c_first, r_first);
 }
 
 /** Convenience function for ranges
@@ -69,9 +288,9 @@ direct(const Kernel& K,
        const SourceRange& s, const ChargeRange& c,
        const TargetRange& t, ResultRange& r)
 {
-  detail::block_eval(K,
-                     s.begin(), s.end(), c.begin(),
-                     t.begin(), t.end(), r.begin());
+  detail::direct_tiled(K,
+                       s.begin(), s.end(), c.begin(),
+                       t.begin(), t.end(), r.begin());
 }
 
 /** Convenience function for ranges
@@ -82,8 +301,8 @@ inline void
 direct(const Kernel& K,
        const STRange& p, const ChargeRange& c, ResultRange& r)
 {
-  detail::block_eval(K,
-                     p.begin(), p.end(), c.begin(), r.begin());
+  detail::direct_tiled(K,
+                       p.begin(), p.end(), c.begin(), r.begin());
 }
 
 
@@ -27,6 +27,12 @@ class FMMOptions {
   unsigned ncrit;  // The maximum number of particles per box in the tree
   double theta;    // The aperture of the standard multipole acceptance criteria
 
+  // PERFORMANCE TUNING
+  std::size_t cache_size;  // Bytes of cache to block the tree passes for, 0: off
+  bool soa_storage;        // Also store the permuted bodies as padded SoA arrays
+  std::size_t near_matrix; // Bytes for a precomputed near-field matrix, 0: off
+  bool mixed_precision;    // Near field in float, accumulated in double
+
   // DEBUGGING FLAGS
   bool print_tree;
 
@@ -34,12 +40,25 @@ class FMMOptions {
   //! Evaluation type
   enum EvalType {FMM, TREECODE};
   EvalType evaluator;
+  //! Execution schedule of the interaction list evaluator
+  enum ExecType {PHASED, TASK_GRAPH};
+  ExecType executor;
+  //! CPU near-field engine: the faster by timing, or forced for runs that
+  //! must be reproducible bit for bit
+  enum NearEngine {AUTO, BOX_LOOP, COMPRESSED};
+  NearEngine near_engine;
 
   FMMOptions()
       : ncrit(128),
         theta(0.5),
+        cache_size(0),
+        soa_storage(false),
+        near_matrix(0),
+        mixed_precision(false),
         print_tree(false),
-        evaluator(FMM) {
+        evaluator(FMM),
+        executor(PHASED),
+        near_engine(AUTO) {
   };
 
   // TODO: Generalize type/construction
@@ -63,8 +82,26 @@ FMMOptions get_options(int argc, char** argv) {
       opts.theta = (double) atof(argv[++i]);
     } else if (strcmp(argv[i],"-ncrit") == 0) {
       opts.ncrit = (unsigned) atoi(argv[++i]);
+    } else if (strcmp(argv[i],"-cachesize") == 0) {
+      opts.cache_size = (std::size_t) atol(argv[++i]);
+    } else if (strcmp(argv[i],"-nearmatrix") == 0) {
+      opts.near_matrix = (std::size_t) atol(argv[++i]);
+    } else if (strcmp(argv[i],"-soa") == 0) {
+      opts.soa_storage = true;
+    } else if (strcmp(argv[i],"-mixed") == 0) {
+      opts.mixed_precision = true;
     } else if (strcmp(argv[i],"-printtree") == 0) {
       opts.print_tree = true;
+    } else if (strcmp(argv[i],"-taskgraph") == 0) {
+      opts.executor = FMMOptions::TASK_GRAPH;
+    } else if (strcmp(argv[i],"-nearengine") == 0) {
+      ++i;
+      if (strcmp(argv[i],"box") == 0)
+        opts.near_engine = FMMOptions::BOX_LOOP;
+      else if (strcmp(argv[i],"compressed") == 0)
+        opts.near_engine = FMMOptions::COMPRESSED;
+      else
+        opts.near_engine = FMMOptions::AUTO;
     }
   }
 
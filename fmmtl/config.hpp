@@ -78,5 +78,18 @@ inline void cuda_check(const char* file, int line) {
 #  warning Compiler does not support OpenMP
 typedef int omp_int_t;
 inline omp_int_t omp_get_thread_num() { return 0;}
+inline omp_int_t omp_get_num_threads() { return 1;}
 inline omp_int_t omp_get_max_threads() { return 1;}
+inline void omp_set_num_threads(omp_int_t) {}
+#endif
+
+// FMMTL_SIMD_WIDTH: The number of doubles in a vector register
+#if !defined(FMMTL_SIMD_WIDTH)
+#  if defined(__AVX512F__)
+#    define FMMTL_SIMD_WIDTH 8
+#  elif defined(__AVX__)
+#    define FMMTL_SIMD_WIDTH 4
+#  else
+#    define FMMTL_SIMD_WIDTH 2
+#  endif
 #endif
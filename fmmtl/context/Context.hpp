@@ -10,10 +10,19 @@
 #include "fmmtl/meta/tree_traits.hpp"
 
 #include "fmmtl/tree/NDTree.hpp"
+#include "fmmtl/tree/TreeData.hpp"
 #include "fmmtl/FMMOptions.hpp"
+#include "fmmtl/context/TranslationCache.hpp"
+#include "fmmtl/context/ExpansionArena.hpp"
 
 #include "fmmtl/dispatch/S2P.hpp"
 #include "fmmtl/dispatch/T2P.hpp"
+#include "fmmtl/dispatch/INITM.hpp"
+#include "fmmtl/dispatch/INITL.hpp"
+
+#include <algorithm>
+#include <vector>
+
 #include <boost/range/adaptor/transformed.hpp>
 
 namespace fmmtl {
@@ -212,6 +221,24 @@ class DataContext
   //! Permuted result data
   std::vector<result_type> results_;
 
+  //! Whether the permuted sources and charges are also stored as
+  //! structure-of-arrays for the SoA batch of the kernel
+  bool soa_;
+  //! Padded structure-of-arrays copies of the permuted source data
+  SoABind<source_type, typename TreeContext::source_tree_type> sources_soa_;
+  SoABind<charge_type, typename TreeContext::source_tree_type> charges_soa_;
+
+  //! Whether the near field may be evaluated in mixed precision
+  bool mixed_;
+
+  //! Whether each source box by index has a body with a non-zero charge
+  std::vector<char> charged_;
+  //! Whether every source box has a body with a non-zero charge
+  bool all_charged_;
+
+  //! The precomputed translations between box centers
+  TranslationCache<expansion_type> translations_;
+
   //! The "multipole acceptance criteria" to decide which boxes to interact
   std::function<bool(const source_box_type&, const target_box_type&)> mac_;
 
@@ -222,6 +249,10 @@ class DataContext
   typedef std::vector<local_type> local_container;
   local_container L_;
 
+  //! Per-level slabs of the coefficients of M_ and L_, if they are views
+  ExpansionArena<multipole_type> M_arena_;
+  ExpansionArena<local_type> L_arena_;
+
  public:
   template <class Options>
   DataContext(const kernel_matrix_type& mat, Options& opts)
@@ -232,10 +263,29 @@ class DataContext
                  this->source_permute_end(  mat_.sources().begin())),
         targets_(this->target_permute_begin(mat_.targets().begin()),
                  this->target_permute_end(  mat_.targets().begin())),
+        soa_(opts.soa_storage &&
+             KernelTraits<kernel_type>::has_soa_batch &&
+             fmmtl::soa_traits<source_type>::value &&
+             fmmtl::soa_traits<charge_type>::value),
+        mixed_(opts.mixed_precision),
         mac_(opts.MAC()),
         // TODO: only allocate if used...
         M_(this->source_tree().boxes()),
         L_(this->target_tree().boxes()) {
+    if (soa_) {
+      sources_soa_ = decltype(sources_soa_)(this->source_tree());
+      sources_soa_.assign(sources_.begin());
+      charges_soa_ = decltype(charges_soa_)(this->source_tree());
+    }
+
+    M_arena_.bind(this->source_tree(), M_,
+                  [this](multipole_type& M, const source_box_type& b) {
+                    INITM::apply(expansion(), M, b.extents(), b.level());
+                  });
+    L_arena_.bind(this->target_tree(), L_,
+                  [this](local_type& L, const target_box_type& b) {
+                    INITL::apply(expansion(), L, b.extents(), b.level());
+                  });
   }
 
   template <typename Executor>
@@ -244,6 +294,10 @@ class DataContext
                       Executor* exec) {
     charges_.assign(this->source_permute_begin(charges.begin()),
                     this->source_permute_end(  charges.begin()));
+    // Padding bodies carry no charge
+    if (soa_)
+      charges_soa_.assign(charges_.begin(), charge_type(0));
+    flag_charged_boxes();
 
     results_.assign(results.size(), result_type(0));
     exec->execute(*this);
@@ -276,6 +330,46 @@ class DataContext
     return L_[box.index()];
   }
 
+  /** Only store the expansions of the boxes flagged in @a m_live and
+   * @a l_live by box index. The expansions of the other boxes are released
+   * and must not be initialized or used afterwards.
+   */
+  void restrict_expansions(const std::vector<char>& m_live,
+                           const std::vector<char>& l_live) {
+    FMMTL_ASSERT(m_live.size() == M_.size() && l_live.size() == L_.size());
+    for (std::size_t k = 0; k < M_.size(); ++k)
+      if (!m_live[k])
+        M_[k] = multipole_type();
+    for (std::size_t k = 0; k < L_.size(); ++k)
+      if (!l_live[k])
+        L_[k] = local_type();
+
+    M_arena_.bind(this->source_tree(), M_,
+                  [this](multipole_type& M, const source_box_type& b) {
+                    INITM::apply(expansion(), M, b.extents(), b.level());
+                  },
+                  [&](const source_box_type& b) {
+                    return bool(m_live[b.index()]);
+                  });
+    L_arena_.bind(this->target_tree(), L_,
+                  [this](local_type& L, const target_box_type& b) {
+                    INITL::apply(expansion(), L, b.extents(), b.level());
+                  },
+                  [&](const target_box_type& b) {
+                    return bool(l_live[b.index()]);
+                  });
+  }
+
+  //! The type of the precomputed translations of the expansion
+  typedef typename ExpansionTraits<expansion_type>::translation_type
+      translation_type;
+  // The precomputed translation from the center of box s to that of box t
+  template <typename SourceBox, typename TargetBox>
+  inline const translation_type& translation(const SourceBox& s,
+                                             const TargetBox& t) {
+    return translations_(expansion(), s, t);
+  }
+
   // Accept or reject the interaction of this source-target box pair
   inline bool mac(const source_box_type& sbox,
                   const target_box_type& tbox) const {
@@ -359,6 +453,80 @@ class DataContext
   inline result_iterator result_end() {
     return this->result(this->target_tree().body_end());
   }
+
+  // Define the structure-of-arrays body data views
+  typedef fmmtl::SoAView<source_type> source_soa_type;
+  typedef fmmtl::SoAView<charge_type> charge_soa_type;
+
+  // Whether the structure-of-arrays views are available
+  inline bool has_soa() const {
+    return soa_;
+  }
+  // Structure-of-arrays views of the sources and charges of a box
+  inline source_soa_type source_soa(const source_box_type& b) const {
+    FMMTL_ASSERT(soa_);
+    return sources_soa_[b];
+  }
+  inline charge_soa_type charge_soa(const source_box_type& b) const {
+    FMMTL_ASSERT(soa_);
+    return charges_soa_[b];
+  }
+  // Structure-of-arrays views of a run of boxes with contiguous bodies
+  inline source_soa_type source_soa(const source_box_type& first,
+                                    const source_box_type& last) const {
+    FMMTL_ASSERT(soa_);
+    return sources_soa_.view(first, last);
+  }
+  inline charge_soa_type charge_soa(const source_box_type& first,
+                                    const source_box_type& last) const {
+    FMMTL_ASSERT(soa_);
+    return charges_soa_.view(first, last);
+  }
+
+  // Whether a source box has a body with a non-zero charge
+  inline bool is_charged(const source_box_type& b) const {
+    return charged_[b.index()];
+  }
+  // Whether every source box has a body with a non-zero charge
+  inline bool all_charged() const {
+    return all_charged_;
+  }
+
+  // Whether kernels with a mixed-precision batch operator should use it
+  inline bool mixed_precision() const {
+    return mixed_;
+  }
+
+ private:
+  /** Flag the source boxes with a non-zero charge so that the operators
+   * out of boxes without charge can be skipped. The leaves are scanned in
+   * parallel, then each box is flagged from its children.
+   */
+  void flag_charged_boxes() {
+    const auto& tree = this->source_tree();
+    const int num_boxes = tree.boxes();
+    charged_.assign(num_boxes, 0);
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int k = 0; k < num_boxes; ++k) {
+      const source_box_type b = tree.box(k);
+      if (b.is_leaf())
+        charged_[k] = std::any_of(charge_begin(b), charge_end(b),
+                                  [](const charge_type& q) {
+                                    return !(q == charge_type(0));
+                                  });
+    }
+
+    // Box indices are ordered by level, children follow their parents
+    all_charged_ = true;
+    for (int k = num_boxes - 1; k >= 0; --k) {
+      const source_box_type b = tree.box(k);
+      if (!b.is_leaf())
+        for (auto ci = b.child_begin(); ci != b.child_end(); ++ci)
+          charged_[k] |= charged_[(*ci).index()];
+      all_charged_ &= bool(charged_[k]);
+    }
+  }
 };
 
 } // end namespace fmmtl
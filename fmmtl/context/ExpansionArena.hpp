@@ -0,0 +1,118 @@
+#pragma once
+/** @file ExpansionArena.hpp
+ * @brief Contiguous storage of the expansions of a tree, one aligned slab
+ * per level.
+ *
+ * The expansions of the boxes of a level all have the same size, so each
+ * level is stored as a single allocation with a fixed, cache-line rounded
+ * stride per box. Expansion types that are not ExpansionVectors keep their
+ * own storage.
+ */
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "fmmtl/config.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
+#include "fmmtl/util/AlignedAllocator.hpp"
+
+namespace fmmtl {
+
+/** Default: the expansions own their storage, nothing to bind */
+template <typename Container,
+          bool = is_expansion_vector<Container>::value>
+class ExpansionArena {
+ public:
+  template <typename Tree, typename Init>
+  void bind(const Tree&, std::vector<Container>&, Init&&) {}
+  template <typename Tree, typename Init, typename Live>
+  void bind(const Tree&, std::vector<Container>&, Init&&, Live&&) {}
+
+  std::size_t bytes() const {
+    return 0;
+  }
+};
+
+template <typename Container>
+class ExpansionArena<Container, true> {
+  // A std::vector<Container> that grows must move the views, not copy them
+  static_assert(std::is_nothrow_move_constructible<Container>::value,
+                "Bound expansions must be nothrow move constructible");
+
+  typedef typename Container::value_type value_type;
+
+  static constexpr std::size_t align = 64;
+  typedef std::vector<value_type, aligned_allocator<value_type,align> > slab;
+
+  //! The coefficients of the expansions of each level
+  std::vector<slab> slabs_;
+
+  /** The smallest stride >= n such that consecutive expansions start on a
+   * cache line */
+  static std::size_t stride(std::size_t n) {
+    std::size_t a = align, b = sizeof(value_type);
+    while (b != 0) {          // gcd(align, sizeof(value_type))
+      std::size_t r = a % b;
+      a = b;
+      b = r;
+    }
+    const std::size_t k = align / a;
+    return (n + k - 1) / k * k;
+  }
+
+ public:
+  /** Bind the expansion @a E[b.index()] of each box b of @a tree to a slice
+   * of the slab of its level.
+   *
+   * @param[in] init  Callable init(Container& E, const box_type& b) that
+   *                  initializes the expansion of box b. It is called once
+   *                  per level on an unbound expansion to size the level.
+   * @param[in] live  Callable live(const box_type& b) that returns whether
+   *                  box b needs an expansion. The other boxes are skipped.
+   */
+  template <typename Tree, typename Init, typename Live>
+  void bind(const Tree& tree, std::vector<Container>& E,
+            Init&& init, Live&& live) {
+    FMMTL_ASSERT(E.size() == tree.boxes());
+    slabs_.assign(tree.levels(), slab());
+
+    for (unsigned L = 0; L < tree.levels(); ++L) {
+      std::size_t num_live = 0;
+      for (auto bi = tree.box_begin(L); bi != tree.box_end(L); ++bi)
+        num_live += bool(live(*bi));
+      if (num_live == 0)
+        continue;
+
+      Container proto;
+      init(proto, *tree.box_begin(L));
+      const std::size_t n = proto.size();
+      const std::size_t s = stride(n);
+
+      slabs_[L].resize(s * num_live);
+      value_type* p = slabs_[L].data();
+      for (auto bi = tree.box_begin(L); bi != tree.box_end(L); ++bi) {
+        if (live(*bi)) {
+          E[(*bi).index()].bind(p, n);
+          p += s;
+        }
+      }
+    }
+  }
+  /** Bind the expansions of all boxes of @a tree */
+  template <typename Tree, typename Init>
+  void bind(const Tree& tree, std::vector<Container>& E, Init&& init) {
+    typedef typename Tree::box_type box_type;
+    bind(tree, E, init, [](const box_type&) { return true; });
+  }
+
+  /** The bytes of memory of the slabs */
+  std::size_t bytes() const {
+    std::size_t b = 0;
+    for (const slab& s : slabs_)
+      b += s.capacity() * sizeof(value_type);
+    return b;
+  }
+};
+
+} // end namespace fmmtl
@@ -0,0 +1,168 @@
+#pragma once
+/** @file TranslationCache.hpp
+ * @brief Caches the precomputed translation operators of an expansion.
+ *
+ * All boxes of a level of an NDTree have the same extents, so the vector
+ * between two box centers is an integer multiple of half the extents of
+ * the finer box. Keyed by the two levels and that integer offset, only a
+ * few hundred distinct M2L translations occur per pair of levels and 2^DIM
+ * distinct M2M and L2L translations.
+ */
+
+#include <array>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "fmmtl/config.hpp"
+#include "fmmtl/meta/kernel_traits.hpp"
+
+namespace fmmtl {
+
+/** The levels of two boxes and the offset between their centers in units
+ * of half the extents of the finer box */
+template <unsigned DIM>
+using TranslationKey = std::array<int, DIM+2>;
+
+struct TranslationKeyHash {
+  template <std::size_t N>
+  std::size_t operator()(const std::array<int, N>& k) const {
+    std::size_t h = 0;
+    for (int v : k)
+      h = (h * 1000003) ^ std::size_t(unsigned(v));
+    return h;
+  }
+};
+
+/** Compute the key of the translation from box @a s to box @a t
+ * @returns Whether the translation is on the lattice of the trees. If not,
+ *          the key does not identify the translation.
+ */
+template <unsigned DIM, typename SourceBox, typename TargetBox>
+bool translation_key(const SourceBox& s, const TargetBox& t,
+                     TranslationKey<DIM>& key) {
+  const auto r = t.center() - s.center();
+  const int ls = s.level();
+  const int lt = t.level();
+  const auto h = (ls > lt ? s.extents() : t.extents()) / 2;
+
+  key[0] = ls;
+  key[1] = lt;
+  bool on_lattice = true;
+  for (unsigned i = 0; i < DIM; ++i) {
+    const double q = std::round(r[i] / h[i]);
+    on_lattice &= (std::abs(r[i] - q * h[i]) <= 1e-8 * h[i]);
+    on_lattice &= (std::abs(q) < (1 << 24));
+    key[i+2] = int(q);
+  }
+  return on_lattice;
+}
+
+/** Per-thread maps from (source level, target level, offset) to the
+ * result of Expansion::make_translation. Each thread fills its own map on
+ * first use of a key, so lookups never lock. Translations that are not on
+ * the lattice of the trees are recomputed on every call.
+ *
+ * The maps live in thread-local storage keyed by the cache, so any number
+ * of threads may call, whatever the thread count when the cache was made.
+ */
+template <typename Expansion>
+class TranslationCache {
+ public:
+  typedef ExpansionTraits<Expansion>                  expansion_traits;
+  typedef typename expansion_traits::translation_type translation_type;
+
+ private:
+  static const unsigned D = expansion_traits::dimension;
+
+  typedef std::unordered_map<TranslationKey<D>, translation_type,
+                             TranslationKeyHash> map_type;
+
+  //! The translations of one thread for one cache
+  struct Slot {
+    //! Expires with the cache that owns the slot
+    std::weak_ptr<char> owner;
+    map_type map;
+    //! The last translation that is not cached
+    std::unique_ptr<translation_type> uncached;
+  };
+
+  //! Identifies this cache to the slots of the threads
+  std::shared_ptr<char> id_;
+
+  /** The slot of the calling thread for this cache. The slots of caches
+   * that no longer exist are dropped when a thread makes a new slot.
+   */
+  Slot& slot() {
+    static thread_local std::unordered_map<const char*, Slot> slots;
+    auto it = slots.find(id_.get());
+    if (it != slots.end() && !it->second.owner.expired())
+      return it->second;
+
+    for (auto i = slots.begin(); i != slots.end(); )
+      i = i->second.owner.expired() ? slots.erase(i) : std::next(i);
+    Slot& s = slots[id_.get()];
+    s.owner = id_;
+    return s;
+  }
+
+  /** The translation r from box @a s to box @a t, with the extents of the
+   * boxes if the expansion accepts them */
+  template <typename SourceBox, typename TargetBox, typename Point,
+            typename E = Expansion>
+  static typename std::enable_if<
+    ExpansionTraits<E>::has_sized_make_translation, translation_type>::type
+  make(const Expansion& K, const Point& r,
+       const SourceBox& s, const TargetBox& t) {
+    return K.make_translation(r, s.extents(), t.extents());
+  }
+  template <typename SourceBox, typename TargetBox, typename Point,
+            typename E = Expansion>
+  static typename std::enable_if<
+    !ExpansionTraits<E>::has_sized_make_translation, translation_type>::type
+  make(const Expansion& K, const Point& r,
+       const SourceBox&, const TargetBox&) {
+    return K.make_translation(r);
+  }
+
+ public:
+  TranslationCache()
+      : id_(std::make_shared<char>()) {
+  }
+  //! Copies start empty, with slots of their own
+  TranslationCache(const TranslationCache&)
+      : TranslationCache() {
+  }
+  TranslationCache& operator=(const TranslationCache&) {
+    return *this;
+  }
+
+  /** The translation from the center of box @a s to the center of box @a t.
+   * The reference is valid until the next call from the same thread.
+   */
+  template <typename SourceBox, typename TargetBox>
+  const translation_type& operator()(const Expansion& K,
+                                     const SourceBox& s, const TargetBox& t) {
+    Slot& slot = this->slot();
+
+    const auto r = t.center() - s.center();
+    TranslationKey<D> key;
+    const bool on_lattice = translation_key<D>(s, t, key);
+
+    if (!on_lattice) {
+      slot.uncached.reset(new translation_type(make(K, r, s, t)));
+      return *slot.uncached;
+    }
+
+    map_type& map = slot.map;
+    auto it = map.find(key);
+    if (it == map.end())
+      it = map.emplace(key, make(K, r, s, t)).first;
+    return it->second;
+  }
+};
+
+} // end namespace fmmtl
@@ -5,6 +5,8 @@
 #include "M2T.hpp"
 #include "M2L.hpp"
 #include "S2L.hpp"
+#include "InteractionList.hpp"
+#include "MatrixM2L.hpp"
 
 #include "fmmtl/meta/kernel_traits.hpp"
 
@@ -17,23 +19,102 @@ class BatchFar {
   typedef typename Context::source_box_type source_box_type;
   typedef typename Context::target_box_type target_box_type;
 
-  //! CSR-like storage of box pairs
-  // XXX: Need to also protect against parent-box races!!
-  std::vector<target_box_type> target_box_list;
-  std::vector<std::vector<source_box_type>> source_boxes;
+  //! CSR storage of the source box indices of each target box
+  InteractionList list_;
+
+  //! Offsets of each tree level into the target list (sorted by level)
+  std::vector<unsigned> level_offset;
+
+  //! The M2L pairs grouped by translation, if the expansion has a matrix M2L
+  fmmtl::MatrixM2L<Context> matrix_m2l_;
+  //! Whether execute(c) applies the M2Ls through matrix_m2l_
+  bool use_matrix_m2l_ = false;
 
  public:
 
-  /** Insert a source-target box interaction to the interaction list */
+  /** First pass: count a source-target box interaction */
+  void count(const source_box_type& s, const target_box_type& t) {
+    list_.count(s, t);
+  }
+  /** Allocate the interaction list after counting */
+  void allocate() {
+    list_.allocate();
+  }
+  /** Second pass: insert a source-target box interaction into the list */
   void insert(const source_box_type& s, const target_box_type& t) {
-    if (source_boxes.size() <= t.index()) {
-      source_boxes.resize(t.index() + 1);
-      target_box_list.push_back(t);
-    } else if (source_boxes[t.index()].empty()) {
-      target_box_list.push_back(t);
+    list_.insert(s, t);
+  }
+  /** Compress the interaction list after inserting */
+  void finalize(Context& c) {
+    list_.finalize(c.source_tree());
+
+    // Box indices are ordered by level
+    level_offset.assign(1, 0);
+    auto& targets = list_.targets();
+    for (unsigned k = 0; k < targets.size(); ++k)
+      while (level_offset.size() <= c.target_tree().box(targets[k]).level())
+        level_offset.push_back(k);
+    level_offset.push_back(targets.size());
+
+    typedef ExpansionTraits<typename Context::expansion_type> expansion_traits;
+    if (expansion_traits::has_L2T && expansion_traits::has_M2L)
+      use_matrix_m2l_ = matrix_m2l_.build(c, list_);
+  }
+
+  /** Flag the source boxes whose multipoles and the target boxes whose
+   * locals the interactions in the list read or write, by box index.
+   */
+  void flag_expansions(const Context& c,
+                       std::vector<char>& m_used,
+                       std::vector<char>& l_used) const {
+    typedef ExpansionTraits<typename Context::expansion_type> expansion_traits;
+    m_used.assign(c.source_tree().boxes(), 0);
+    l_used.assign(c.target_tree().boxes(), 0);
+
+    // The operators chosen by execute(c, tb)
+    const bool use_M = expansion_traits::has_L2T ? expansion_traits::has_M2L
+                                                 : expansion_traits::has_S2M;
+    const bool use_L = expansion_traits::has_L2T;
+
+    for (unsigned t : list_.targets()) {
+      l_used[t] = use_L;
+      auto e_end = list_.end(t);
+      for (auto ei = list_.begin(t); ei != e_end; ++ei) {
+        const unsigned s_last = InteractionList::last(*ei);
+        for (unsigned s = InteractionList::first(*ei); s != s_last; ++s)
+          m_used[s] = use_M;
+      }
     }
+  }
 
-    source_boxes[t.index()].push_back(s);
+  /** The interaction list */
+  const InteractionList& list() const {
+    return list_;
+  }
+
+  /** Compute the interactions of a single target box in the list
+   * Accumulates into the local expansion of @a tb if the expansion has an L2T,
+   * otherwise directly into the results of the bodies of @a tb.
+   */
+  void execute(Context& c, const target_box_type& tb) {
+    typedef ExpansionTraits<typename Context::expansion_type> expansion_traits;
+    auto e_end = list_.end(tb.index());
+    for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei) {
+      const unsigned s_last = InteractionList::last(*ei);
+      for (unsigned s = InteractionList::first(*ei); s != s_last; ++s) {
+        source_box_type sb = c.source_tree().box(s);
+        // A hacky adaption on the operator graph
+        // TODO: Actually measure/autotune these
+        if (expansion_traits::has_L2T) {
+          if (expansion_traits::has_M2L)
+            M2L::eval(c, sb, tb);
+          else
+            S2L::eval(c, sb, tb);
+        } else if (expansion_traits::has_S2M) {
+          M2T::eval(c, sb, tb);
+        }
+      }
+    }
   }
 
   /** Compute all interations in the interaction list */
@@ -41,28 +122,24 @@ class BatchFar {
     FMMTL_LOG("FarBatch");
     // Choose which operators are available and dispatch to it
     // XXX: Hacky version
+    auto& targets = list_.targets();
 
-    if (ExpansionTraits<typename Context::expansion_type>::has_L2T) {
-      // Need iterator style for OMP compatibility.
+    if (use_matrix_m2l_) {
+      matrix_m2l_.execute(c);
+    } else if (ExpansionTraits<typename Context::expansion_type>::has_L2T) {
 #pragma omp parallel for
-      for (auto ti = target_box_list.begin(); ti < target_box_list.end(); ++ti) {
-        target_box_type& tb = *ti;
-        auto s_end = source_boxes[tb.index()].end();
-        for (auto si = source_boxes[tb.index()].begin(); si != s_end; ++si) {
-          // A hacky adaption on the operator graph
-          // TODO: Actually measure/autotune these
-          if (ExpansionTraits<typename Context::expansion_type>::has_M2L) {
-            M2L::eval(c, *si, tb);
-          } else if (ExpansionTraits<typename Context::expansion_type>::has_L2T) {
-            S2L::eval(c, *si, tb);
-          }
-        }
-      }
+      for (unsigned k = 0; k < targets.size(); ++k)
+        execute(c, c.target_tree().box(targets[k]));
     } else if (ExpansionTraits<typename Context::expansion_type>::has_S2M) {
-      // XXX: can't run in parallel with the current data structure
-      for (auto tb : target_box_list)
-        for (auto sb : source_boxes[tb.index()])
-          M2T::eval(c, sb, tb);
+      // M2T writes to the results of all bodies of a (possibly non-leaf)
+      // target box. The boxes of a level own disjoint bodies, so process the
+      // levels in order and the boxes of each level in parallel.
+      for (unsigned L = 0; L+1 < level_offset.size(); ++L) {
+        const unsigned k_end = level_offset[L+1];
+#pragma omp parallel for schedule(dynamic)
+        for (unsigned k = level_offset[L]; k < k_end; ++k)
+          execute(c, c.target_tree().box(targets[k]));
+      }
     }
   }
 };
@@ -2,8 +2,12 @@
 
 #include <cmath>
 #include <vector>
+#include <iostream>
+#include <algorithm>
 
+#include "fmmtl/dispatch/InteractionList.hpp"
 #include "fmmtl/dispatch/S2T/S2T_Compressed.hpp"
+#include "fmmtl/util/Clock.hpp"
 
 /** A lazy S2T evaluator which saves a list of pairs of boxes
  * That are sent to the S2T dispatcher on demand.
@@ -14,147 +18,351 @@ class BatchNear {
   typedef typename Context::kernel_type kernel_type;
   //! Kernel value type
   typedef typename Context::kernel_value_type kernel_value_type;
+  //! Body types
+  typedef typename Context::source_type source_type;
+  typedef typename Context::charge_type charge_type;
 
   //! Type of box
   typedef typename Context::source_box_type source_box_type;
   typedef typename Context::target_box_type target_box_type;
 
-  std::vector<target_box_type> target_box_list;
-  std::vector<std::vector<source_box_type>> source_boxes;
-  unsigned box_pair_count;
+  //! CSR storage of the source box runs of each target box
+  InteractionList list_;
+  //! Kernel evaluations of each target box, in the order of list_.targets()
+  std::vector<double> cost_;
+  //! Positions in list_.targets() sorted by decreasing cost
+  std::vector<unsigned> order_;
 
-  //! Box list for S2T interactions    TODO: could further compress these...
-  //typedef std::pair<source_box_type, target_box_type> box_pair;
-  //std::vector<box_pair> p2p_list;
-
-  // For now, only use for GPU...
+  //! Compressed range-to-range form of the list
   S2T_Compressed<kernel_type>* p2p_compressed;
 
+  //! Precomputed kernel values of the list, one dense block per entry
+  std::vector<kernel_value_type> matrix_;
+  //! Offset into matrix_ of the blocks of each target box by index
+  std::vector<std::size_t> matrix_offset_;
+
+  //! The engine that computes the whole batch on the CPU
+  enum Engine {UNTUNED, BOX_LOOP, COMPRESSED};
+  Engine engine_;
+  //! Number of executions while UNTUNED
+  unsigned tuning_runs_;
+  //! Time of the warm execution of the per-box loop
+  double box_loop_time_;
+
  public:
   BatchNear()
-      : box_pair_count(0), p2p_compressed(nullptr) {
+      : p2p_compressed(nullptr),
+        engine_(UNTUNED),
+        tuning_runs_(0),
+        box_loop_time_(0) {
   }
   ~BatchNear() {
     delete p2p_compressed;
   }
 
-  /** Insert a source-target box interaction to the interaction list */
+  /** First pass: count a source-target box interaction */
+  void count(const source_box_type& s, const target_box_type& t) {
+    list_.count(s, t);
+  }
+  /** Allocate the interaction list after counting */
+  void allocate() {
+    list_.allocate();
+  }
+  /** Second pass: insert a source-target box interaction into the list */
   void insert(const source_box_type& s, const target_box_type& t) {
-    if (source_boxes.size() <= t.index()) {
-      source_boxes.resize(t.index() + 1);
-      target_box_list.push_back(t);
-    } else if (source_boxes[t.index()].empty()) {
-      target_box_list.push_back(t);
+    list_.insert(s, t);
+  }
+  /** Compress the interaction list after inserting and order the target
+   * boxes by their cost, sum_S |T|*|S| over the runs S of target box T
+   */
+  void finalize(Context& c) {
+    list_.finalize(c.source_tree());
+
+    auto& targets = list_.targets();
+    cost_.resize(targets.size());
+    for (unsigned k = 0; k < targets.size(); ++k) {
+      const target_box_type tb = c.target_tree().box(targets[k]);
+      double num_sources = 0;
+      auto e_end = list_.end(tb.index());
+      for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei)
+        num_sources += run_size(c, *ei);
+      cost_[k] = tb.num_bodies() * num_sources;
     }
 
-    source_boxes[t.index()].push_back(s);
-    ++box_pair_count;
+    order_.resize(targets.size());
+    for (unsigned k = 0; k < order_.size(); ++k)
+      order_[k] = k;
+    std::stable_sort(order_.begin(), order_.end(),
+                     [&](unsigned a, unsigned b) {
+                       return cost_[a] > cost_[b];
+                     });
+  }
 
-    //p2p_list.push_back(std::make_pair(s,t));
+  /** The interaction list */
+  const InteractionList& list() const {
+    return list_;
+  }
+
+  /** Precompute the kernel values of the list as a block-sparse matrix,
+   * one dense row-major block for each (target box, source run) entry, so
+   * that each execution is a sequence of block matrix-vector products.
+   *
+   * @param budget  The maximum bytes of the matrix
+   * @returns Whether the matrix fits in the budget and was computed.
+   *          Otherwise, the kernel values are recomputed in each execution.
+   */
+  bool precompute(Context& c, std::size_t budget) {
+    auto& targets = list_.targets();
+
+    // The kernel values of each target box
+    std::vector<std::size_t> offset(targets.size() + 1, 0);
+    for (unsigned k = 0; k < targets.size(); ++k)
+      offset[k+1] = offset[k] + std::size_t(cost_[k]);
+
+    const std::size_t bytes = offset.back() * sizeof(kernel_value_type);
+    if (bytes > budget) {
+      std::cerr << "WARNING: Near-field matrix needs " << bytes
+                << " bytes, over the budget of " << budget
+                << ". Recomputing the kernel values instead." << std::endl;
+      return false;
+    }
+
+    if (offset.back() == 0)
+      return false;
+
+    // Evaluate the blocks of each target box. Kernel values need not be
+    // default constructible, so allocate with copies of any kernel value.
+    matrix_.assign(offset.back(),
+                   c.kernel()(*c.target_begin(), *c.source_begin()));
+    matrix_offset_.assign(c.target_tree().boxes(), 0);
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned k = 0; k < targets.size(); ++k) {
+      const target_box_type tb = c.target_tree().box(targets[k]);
+      matrix_offset_[tb.index()] = offset[k];
+
+      auto A = matrix_.begin() + offset[k];
+      auto e_end = list_.end(tb.index());
+      for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei) {
+        const source_box_type sfirst = run_first(c, *ei);
+        const source_box_type slast  = run_last(c, *ei);
+        auto s_end = c.source_end(slast);
+        auto t_end = c.target_end(tb);
+        for (auto t = c.target_begin(tb); t != t_end; ++t)
+          for (auto s = c.source_begin(sfirst); s != s_end; ++s, ++A)
+            *A = c.kernel()(*t, *s);
+      }
+    }
+    return true;
+  }
+
+  /** Use the per-box loop or the compressed engine for every execution of
+   * the whole batch instead of the faster of the two by timing. The
+   * precomputed matrix, the mixed-precision kernels, and the skipping of
+   * boxes without charge still use the per-box loop.
+   */
+  void set_engine(bool compressed) {
+    engine_ = compressed ? COMPRESSED : BOX_LOOP;
+  }
+
+  /** Compute the interactions of a single target box in the list */
+  void execute(Context& c, const target_box_type& tb) {
+    if (!matrix_.empty()) {
+      execute_matrix(c, tb);
+      return;
+    }
+    if (gather_sources(c) &&
+        list_.end(tb.index()) - list_.begin(tb.index()) > 1) {
+      execute_gathered(c, tb);
+      return;
+    }
+
+    auto e_end = list_.end(tb.index());
+    for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei) {
+      // The charged sub-runs of a run of boxes with contiguous bodies
+      for_each_charged(c, *ei,
+                       [&](const source_box_type& sfirst,
+                           const source_box_type& slast) {
+                         S2T::eval(c, sfirst, slast, tb, S2T::ONE_SIDED());
+                       });
+    }
   }
 
   /** Compute all interations in the interaction list */
   void execute(Context& c) {
     FMMTL_LOG("S2T Batch");
+    // The precomputed matrix, the mixed-precision kernels, and the skipping
+    // of boxes without charge are only reached through the per-box dispatch
+    if (!matrix_.empty() || !c.all_charged() ||
+        (KernelTraits<kernel_type>::has_mixed_batch && c.mixed_precision())) {
+      execute_boxes(c);
+      return;
+    }
 #if defined(FMMTL_WITH_CUDA)        // XXX: Dispatch this
     if (p2p_compressed == nullptr)
-      p2p_compressed =
-          S2T_Compressed<kernel_type>::make(c, target_box_list, source_boxes, box_pair_count);
+      p2p_compressed = S2T_Compressed<kernel_type>::make(c, list_);
     p2p_compressed->execute(c);
 #else
-    auto t_end = target_box_list.end();
-#pragma omp parallel for
-    for (auto ti = target_box_list.begin(); ti < t_end; ++ti) {
-      target_box_type& tb = *ti;
-      auto s_end = source_boxes[tb.index()].end();
-      for (auto si = source_boxes[tb.index()].begin(); si != s_end; ++si) {
-        S2T::eval(c, *si, tb, S2T::ONE_SIDED());
-      }
+    switch (engine_) {
+      case BOX_LOOP:
+        execute_boxes(c);
+        return;
+      case COMPRESSED:
+        if (p2p_compressed == nullptr)
+          p2p_compressed = S2T_Compressed<kernel_type>::make(c, list_);
+        p2p_compressed->execute(c);
+        return;
+      case UNTUNED:
+        break;
+    }
+
+    // Each engine first runs once to warm the caches and touch its memory,
+    // then once timed, and the faster of the two is kept
+    Clock timer;
+    switch (tuning_runs_++) {
+      case 0:
+        execute_boxes(c);
+        break;
+      case 1:
+        p2p_compressed = S2T_Compressed<kernel_type>::make(c, list_);
+        p2p_compressed->execute(c);
+        break;
+      case 2:
+        timer.start();
+        execute_boxes(c);
+        box_loop_time_ = timer.seconds();
+        break;
+      default:
+        timer.start();
+        p2p_compressed->execute(c);
+        if (timer.seconds() < box_loop_time_) {
+          engine_ = COMPRESSED;
+        } else {
+          engine_ = BOX_LOOP;
+          delete p2p_compressed;
+          p2p_compressed = nullptr;
+        }
     }
 #endif
   }
 
-  /*
-  class S2T_Matrix
-      : public EvaluatorBase<Context> {
-    ublas::compressed_matrix<kernel_value_type> A;
-
-   public:
-    virtual void execute(Context& c) {
-      // printf("EvalLocalSparse::execute(Context&)\n");
+ private:
+  /** Compute all interactions with the S2T dispatcher, target box by box.
+   * The costliest boxes are handed out first and the rest fill in behind
+   * them, so the threads finish together even when the costs of the boxes
+   * differ by orders of magnitude. The time of each thread is logged.
+   */
+  void execute_boxes(Context& c) {
+    auto& targets = list_.targets();
+#pragma omp parallel
+    {
+      FMMTL_LOG("S2T Batch thread");
+#pragma omp for schedule(dynamic) nowait
+      for (unsigned k = 0; k < order_.size(); ++k)
+        execute(c, c.target_tree().box(targets[order_[k]]));
+    }
+  }
 
-      typedef typename Context::charge_type charge_type;
-      ublas::vector<charge_type> charges(c.source_tree().bodies());
-      std::copy(c.charge_begin(), c.charge_end(), charges.begin());
+  /** Whether the per-box loop gathers the source runs of each target box.
+   * Only the kernel's batch operator gains from the longer source range,
+   * and the SoA and mixed-precision dispatches keep their own layouts.
+   */
+  static bool gather_sources(Context& c) {
+    typedef KernelTraits<kernel_type> kernel_traits;
+    return kernel_traits::has_batch &&
+        !(kernel_traits::has_soa_batch && c.has_soa()) &&
+        !(kernel_traits::has_mixed_batch && c.mixed_precision());
+  }
 
-      // Call the matvec
-      typedef typename Context::result_type result_type;
-      ublas::vector<result_type> results = ublas::prod(A, charges);
+  /** Copy the sources and charges of all runs of a target box into one
+   * contiguous tile and evaluate it with a single block evaluation, so
+   * each target's sums stay in registers across the whole list.
+   */
+  void execute_gathered(Context& c, const target_box_type& tb) {
+    static thread_local std::vector<source_type> s_buf;
+    static thread_local std::vector<charge_type> c_buf;
+    s_buf.clear();
+    c_buf.clear();
 
-      // Accumulate results
-      std::transform(results.begin(), results.end(),
-                     c.result_begin(), c.result_begin(),
-                     std::plus<result_type>());
+    auto e_end = list_.end(tb.index());
+    for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei) {
+      for_each_charged(c, *ei,
+                       [&](const source_box_type& sfirst,
+                           const source_box_type& slast) {
+                         s_buf.insert(s_buf.end(), c.source_begin(sfirst),
+                                      c.source_end(slast));
+                         c_buf.insert(c_buf.end(), c.charge_begin(sfirst),
+                                      c.charge_end(slast));
+                       });
     }
-  };
-  */
+    if (s_buf.empty())
+      return;
 
+    fmmtl::detail::block_eval(c.kernel(),
+                              s_buf.cbegin(), s_buf.cend(), c_buf.cbegin(),
+                              c.target_begin(tb), c.target_end(tb),
+                              c.result_begin(tb));
+  }
 
-  /** Convert the interaction list to an interaction matrix
-   * by evaluating all of the elements.
+  /** Apply the precomputed blocks of a target box.
+   * Only the columns of the charged boxes of each run are read.
    */
-  /*
-  ublas::compressed_matrix<kernel_value_type> to_matrix(Context& bc) {
-    auto first_source = bc.source_begin();
-    auto first_target = bc.target_begin();
-
-    // Interaction list for each target body
-    unsigned rows = bc.target_tree().bodies();
-    unsigned cols = 0;
-    unsigned nnz = 0;
-    std::vector<std::vector<unsigned>> csr(rows);
-
-    for (const box_pair& b2b : p2p_list) {
-      const source_box_type& box1 = b2b.first;
-      const target_box_type& box2 = b2b.second;
-
-      auto source_end = bc.source_end(box1);
-      auto target_end = bc.target_end(box2);
-      for (auto t = bc.target_begin(box2); t != target_end; ++t) {
-        // Row
-        unsigned i = t - first_target;
-        std::vector<unsigned>& csri = csr[i];
-
-        for (auto s = bc.source_begin(box1); s != source_end; ++s) {
-          // Column
-          unsigned j = s - first_source;
-
-          //FMMTL_ASSERT(std::find(csri.begin(), csri.end(), j) == csri.end());
-          csri.push_back(j);
-          ++nnz;
-          cols = std::max(cols, j);
-        }
-      }
+  void execute_matrix(Context& c, const target_box_type& tb) {
+    auto A = matrix_.cbegin() + matrix_offset_[tb.index()];
+    auto e_end = list_.end(tb.index());
+    for (auto ei = list_.begin(tb.index()); ei != e_end; ++ei) {
+      const auto c_run = c.charge_begin(run_first(c, *ei));
+      const std::size_t n = run_size(c, *ei);
+      for_each_charged(c, *ei,
+                       [&](const source_box_type& sfirst,
+                           const source_box_type& slast) {
+                         auto c_begin = c.charge_begin(sfirst);
+                         auto c_end   = c.charge_end(slast);
+                         auto Ar = A + (c_begin - c_run);
+                         auto r = c.result_begin(tb);
+                         auto r_end = c.result_end(tb);
+                         for ( ; r != r_end; ++r, Ar += n) {
+                           auto Aij = Ar;
+                           for (auto ci = c_begin; ci != c_end; ++ci, ++Aij)
+                             *r += (*Aij) * (*ci);
+                         }
+                       });
+      A += n * tb.num_bodies();
     }
-    ++cols;
-
-    // The precomputed interaction matrix
-    ublas::compressed_matrix<kernel_value_type> m(rows, cols, nnz);
-
-    typedef typename kernel_type::source_type source_type;
-    typedef typename kernel_type::target_type target_type;
-    for (unsigned i = 0; i < csr.size(); ++i) {
-      // Insert elements to compressed_matrix in-order for efficiency
-      std::sort(csr[i].begin(), csr[i].end());
-      const target_type& target = first_target[i];
+  }
 
-      for (unsigned j : csr[i]) {
-        const source_type& source = first_source[j];
-        m.push_back(i, j, bc.kernel()(target, source));
-      }
+  /** Call @a f(first, last) on each maximal sub-run of the run @a e whose
+   * source boxes all have a non-zero charge
+   */
+  template <typename Function>
+  static void for_each_charged(Context& c, InteractionList::index_type e,
+                               Function f) {
+    const unsigned s_end = InteractionList::last(e);
+    unsigned s = InteractionList::first(e);
+    if (c.all_charged()) {
+      f(c.source_tree().box(s), c.source_tree().box(s_end - 1));
+      return;
+    }
+    while (true) {
+      while (s != s_end && !c.is_charged(c.source_tree().box(s)))
+        ++s;
+      if (s == s_end)
+        return;
+      unsigned r = s + 1;
+      while (r != s_end && c.is_charged(c.source_tree().box(r)))
+        ++r;
+      f(c.source_tree().box(s), c.source_tree().box(r - 1));
+      s = r;
     }
+  }
 
-    return m;
+  //! The first and last source boxes of a run and its number of bodies
+  static source_box_type run_first(Context& c, InteractionList::index_type e) {
+    return c.source_tree().box(InteractionList::first(e));
+  }
+  static source_box_type run_last(Context& c, InteractionList::index_type e) {
+    return c.source_tree().box(InteractionList::last(e) - 1);
+  }
+  static std::size_t run_size(Context& c, InteractionList::index_type e) {
+    return c.source_end(run_last(c, e)) - c.source_begin(run_first(c, e));
   }
-  */
 };
@@ -0,0 +1,190 @@
+#pragma once
+/** @file InteractionList
+ * @brief Compact storage of the source boxes that each target box interacts
+ * with, as flat CSR arrays of 32-bit box indices.
+ */
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "fmmtl/config.hpp"
+#include "fmmtl/dispatch/MAC.hpp"
+#include "fmmtl/traversal/DualTraversal.hpp"
+
+/** @class InteractionList
+ * @brief CSR lists of source box indices, one list per target box.
+ *
+ * Each entry of a list packs a run of consecutive source boxes
+ * [first, first+count) into 32 bits: the index of the first box in the low
+ * bits and count-1 in the high bits. Only boxes whose bodies are also
+ * contiguous are merged into a run, so the bodies of a run form one range.
+ * The offsets of the lists are 64-bit, so only the source box indices are
+ * limited: count() throws std::length_error for a source tree with more than
+ * 2^index_bits boxes.
+ *
+ * The lists are built in two passes over the same interactions:
+ *   for each (s,t): count(s,t);
+ *   allocate();
+ *   for each (s,t): insert(s,t);
+ *   finalize(source_tree);
+ */
+class InteractionList {
+ public:
+  typedef std::uint32_t index_type;
+  typedef std::size_t   offset_type;
+
+  //! Bits of an entry used for the run length
+  static constexpr unsigned run_bits  = 4;
+  static constexpr unsigned index_bits = 32 - run_bits;
+  static constexpr index_type max_run   = index_type(1) << run_bits;
+  static constexpr index_type index_mask = (index_type(1) << index_bits) - 1;
+
+  //! Index of the first source box of an entry
+  static index_type first(index_type entry) {
+    return entry & index_mask;
+  }
+  //! One past the index of the last source box of an entry
+  static index_type last(index_type entry) {
+    return first(entry) + (entry >> index_bits) + 1;
+  }
+
+ private:
+  //! The indices of the target boxes with a non-empty list, in index order
+  std::vector<index_type> targets_;
+  //! Offsets into entries_ of the list of each target box index
+  std::vector<offset_type> ptr_;
+  //! The packed source box runs
+  std::vector<index_type> entries_;
+
+  //! The next entry to fill for each target box index (second pass only)
+  std::vector<offset_type> fill_;
+
+ public:
+  /** First pass: count the interaction of source box @a s and target box @a t
+   * @throw std::length_error if the index of @a s does not fit in index_bits
+   */
+  template <class SourceBox, class TargetBox>
+  void count(const SourceBox& s, const TargetBox& t) {
+    if (s.index() > index_mask)
+      throw std::length_error("InteractionList: too many source boxes");
+    if (ptr_.size() < t.index() + 2)
+      ptr_.resize(t.index() + 2, 0);
+    ++ptr_[t.index() + 1];
+  }
+
+  /** Allocate the lists after all interactions have been counted */
+  void allocate() {
+    for (unsigned k = 1; k < ptr_.size(); ++k)
+      ptr_[k] += ptr_[k-1];
+    entries_.resize(ptr_.empty() ? 0 : ptr_.back());
+    fill_.assign(ptr_.begin(), ptr_.end());
+  }
+
+  /** Second pass: record the interaction of source box @a s and target box @a t
+   * @pre count(s,t) was called in the first pass
+   */
+  template <class SourceBox, class TargetBox>
+  void insert(const SourceBox& s, const TargetBox& t) {
+    FMMTL_ASSERT(fill_[t.index()] < ptr_[t.index()+1]);
+    entries_[fill_[t.index()]++] = s.index();
+  }
+
+  /** Sort each list and merge runs of consecutive source boxes
+   * whose bodies are contiguous.
+   */
+  template <class SourceTree>
+  void finalize(const SourceTree& tree) {
+    std::vector<offset_type>().swap(fill_);
+
+    offset_type out = 0;
+    offset_type begin = 0;
+    for (index_type t = 0; t+1 < ptr_.size(); ++t) {
+      offset_type end = ptr_[t+1];
+      std::sort(entries_.begin() + begin, entries_.begin() + end);
+
+      ptr_[t] = out;
+      if (begin != end)
+        targets_.push_back(t);
+      for (offset_type k = begin; k != end; ) {
+        index_type s = entries_[k];
+        index_type run = 1;
+        for (++k; k != end && run < max_run && entries_[k] == s + run &&
+                 tree.box(s+run-1).body_end() == tree.box(s+run).body_begin();
+             ++k)
+          ++run;
+        entries_[out++] = s | ((run-1) << index_bits);
+      }
+      begin = end;
+    }
+    if (!ptr_.empty())
+      ptr_.back() = out;
+    entries_.resize(out);
+    entries_.shrink_to_fit();
+  }
+
+  //! The indices of the target boxes with a non-empty list, in index order
+  const std::vector<index_type>& targets() const {
+    return targets_;
+  }
+
+  //! The list of target box index @a t as a range of packed entries
+  typedef std::vector<index_type>::const_iterator entry_iterator;
+  entry_iterator begin(index_type t) const {
+    return entries_.begin() + (t+1 < ptr_.size() ? ptr_[t] : 0);
+  }
+  entry_iterator end(index_type t) const {
+    return entries_.begin() + (t+1 < ptr_.size() ? ptr_[t+1] : 0);
+  }
+
+  //! The number of packed entries over all lists
+  std::size_t entries() const {
+    return entries_.size();
+  }
+
+  //! The bytes of memory used by the lists
+  std::size_t bytes() const {
+    return sizeof(*this) +
+        sizeof(index_type) * (targets_.capacity() + entries_.capacity()) +
+        sizeof(offset_type) * ptr_.capacity();
+  }
+};
+
+
+/** Determine the near- and far-field box interactions of a context with a
+ * dual-tree traversal and store them in the near and far batches.
+ *
+ * The traversal is run twice: once to count the interactions of each target
+ * box and once to fill the allocated lists.
+ */
+template <class Context, class NearBatch, class FarBatch>
+void build_interaction_lists(Context& c, NearBatch& near, FarBatch& far) {
+  typedef typename Context::source_box_type source_box;
+  typedef typename Context::target_box_type target_box;
+
+  for (int pass = 0; pass < 2; ++pass) {
+    auto far_batcher = [&](const source_box& s, const target_box& t) {
+      if (MAC::eval(c,s,t)) {
+        if (pass == 0) far.count(s,t);
+        else           far.insert(s,t);
+        return true;
+      }
+      return false;
+    };
+    auto near_batcher = [&](const source_box& s, const target_box& t) {
+      if (pass == 0) near.count(s,t);
+      else           near.insert(s,t);
+    };
+    fmmtl::traverse_nearfar(c.source_tree().root(), c.target_tree().root(),
+                            near_batcher, far_batcher);
+
+    if (pass == 0) {
+      near.allocate();
+      far.allocate();
+    }
+  }
+
+  near.finalize(c);
+  far.finalize(c);
+}
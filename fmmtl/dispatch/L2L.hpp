@@ -4,6 +4,8 @@
  *
  */
 
+#include <type_traits>
+
 #include "fmmtl/util/Logger.hpp"
 #include "fmmtl/meta/kernel_traits.hpp"
 
@@ -34,14 +36,29 @@ struct L2L_Helper<true> {
 
   /** Unpack from Context and apply */
   template <typename Context>
-  inline static void eval(Context& c,
-                          const typename Context::target_box_type& sbox,
-                          const typename Context::target_box_type& tbox) {
+  inline static
+  typename std::enable_if<!ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_L2L>::type
+  eval(Context& c,
+       const typename Context::target_box_type& sbox,
+       const typename Context::target_box_type& tbox) {
     apply(c.expansion(),
           c.local(sbox),
           c.local(tbox),
           tbox.center() - sbox.center());
   }
+
+  /** Unpack from Context and apply with the cached translation */
+  template <typename Context>
+  inline static
+  typename std::enable_if<ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_L2L>::type
+  eval(Context& c,
+       const typename Context::target_box_type& sbox,
+       const typename Context::target_box_type& tbox) {
+    c.expansion().L2L(
+        c.local(sbox), c.local(tbox), c.translation(sbox, tbox));
+  }
 };
 
 // Public L2L dispatcher
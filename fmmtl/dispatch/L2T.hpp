@@ -39,8 +39,7 @@ struct L2T_Helper<true> {
   /** The Expansion provides a scalar L2T accumulator. */
   template <typename Expansion>
   inline static
-  typename std::enable_if<ExpansionTraits<Expansion>::has_scalar_L2T &
-                          !ExpansionTraits<Expansion>::has_vector_L2T>::type
+  typename std::enable_if<ExpansionTraits<Expansion>::has_scalar_L2T>::type
   apply(const Expansion& K,
         const typename Expansion::local_type& L,
         const typename Expansion::point_type& center,
@@ -49,6 +48,19 @@ struct L2T_Helper<true> {
     K.L2T(L, center, target, result);
   }
 
+  /** The Expansion provides only a vector L2T accumulator. */
+  template <typename Expansion>
+  inline static
+  typename std::enable_if<!ExpansionTraits<Expansion>::has_scalar_L2T &
+                          ExpansionTraits<Expansion>::has_vector_L2T>::type
+  apply(const Expansion& K,
+        const typename Expansion::local_type& L,
+        const typename Expansion::point_type& center,
+        const typename Expansion::target_type& target,
+              typename Expansion::result_type& result) {
+    K.L2T(L, center, &target, &target + 1, &result);
+  }
+
   /** The Expansion provides a scalar L2T accumulator. */
   template <typename Expansion, typename TargetIter, typename ResultIter>
   inline static
@@ -4,6 +4,8 @@
  *
  */
 
+#include <type_traits>
+
 #include "fmmtl/util/Logger.hpp"
 #include "fmmtl/meta/kernel_traits.hpp"
 
@@ -34,14 +36,29 @@ struct M2L_Helper<true> {
 
   /** Unpack from Context and apply */
   template <typename Context>
-  inline static void eval(Context& c,
-                          const typename Context::source_box_type& sbox,
-                          const typename Context::target_box_type& tbox) {
+  inline static
+  typename std::enable_if<!ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_M2L>::type
+  eval(Context& c,
+       const typename Context::source_box_type& sbox,
+       const typename Context::target_box_type& tbox) {
     apply(c.expansion(),
           c.multipole(sbox),
           c.local(tbox),
           tbox.center() - sbox.center());
   }
+
+  /** Unpack from Context and apply with the cached translation */
+  template <typename Context>
+  inline static
+  typename std::enable_if<ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_M2L>::type
+  eval(Context& c,
+       const typename Context::source_box_type& sbox,
+       const typename Context::target_box_type& tbox) {
+    c.expansion().M2L(
+        c.multipole(sbox), c.local(tbox), c.translation(sbox, tbox));
+  }
 };
 
 // Public M2L dispatcher
@@ -61,6 +78,9 @@ struct M2L {
                           const typename Context::source_box_type& sbox,
                           const typename Context::target_box_type& tbox)
   {
+    if (!c.is_charged(sbox))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "M2L:"
               << "\n  " << sbox
@@ -4,6 +4,8 @@
  *
  */
 
+#include <type_traits>
+
 #include "fmmtl/util/Logger.hpp"
 #include "fmmtl/meta/kernel_traits.hpp"
 
@@ -34,14 +36,29 @@ struct M2M_Helper<true> {
 
   /** Unpack from Context and apply */
   template <typename Context>
-  inline static void eval(Context& c,
-                          const typename Context::source_box_type& sbox,
-                          const typename Context::source_box_type& tbox) {
+  inline static
+  typename std::enable_if<!ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_M2M>::type
+  eval(Context& c,
+       const typename Context::source_box_type& sbox,
+       const typename Context::source_box_type& tbox) {
     apply(c.expansion(),
           c.multipole(sbox),
           c.multipole(tbox),
           tbox.center() - sbox.center());
   }
+
+  /** Unpack from Context and apply with the cached translation */
+  template <typename Context>
+  inline static
+  typename std::enable_if<ExpansionTraits<typename Context::expansion_type>
+                          ::has_cached_M2M>::type
+  eval(Context& c,
+       const typename Context::source_box_type& sbox,
+       const typename Context::source_box_type& tbox) {
+    c.expansion().M2M(
+        c.multipole(sbox), c.multipole(tbox), c.translation(sbox, tbox));
+  }
 };
 
 // Public M2M dispatcher
@@ -62,6 +79,10 @@ struct M2M {
                           const typename Context::source_box_type& sbox,
                           const typename Context::source_box_type& tbox)
   {
+    // A child without charge adds nothing to its parent
+    if (!c.is_charged(sbox))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "M2M:"
               << "\n  " << sbox
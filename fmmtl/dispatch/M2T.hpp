@@ -92,6 +92,9 @@ struct M2T {
                           const typename Context::source_box_type& sbox,
                           const typename Context::target_box_type& tbox)
   {
+    if (!c.is_charged(sbox))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "M2T:"
               << "\n  " << sbox
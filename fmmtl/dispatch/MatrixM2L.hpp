@@ -0,0 +1,220 @@
+#pragma once
+/** @file MatrixM2L.hpp
+ * @brief Batched M2L for expansions that provide their M2L as a matrix.
+ *
+ * All M2Ls between two levels with the same offset of box centers apply the
+ * same operator. The pairs of an interaction list are grouped by that
+ * translation and each group is applied as GEMMs on blocks of multipoles
+ * packed as the columns of a matrix. Each entry of the operator is then
+ * loaded once per block of expansions rather than once per expansion.
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fmmtl/config.hpp"
+#include "fmmtl/context/TranslationCache.hpp"
+#include "fmmtl/meta/kernel_traits.hpp"
+#include "InteractionList.hpp"
+
+namespace fmmtl {
+
+/** Y += A * X where A is the row-major m x k matrix and X and Y are the
+ * row-major k x n and m x n blocks with leading dimension ld.
+ * Blocked over k so that the rows of X in use stay in cache.
+ */
+template <typename T>
+void gemm_acc(unsigned m, unsigned k, unsigned n,
+              const T* A, const T* X, T* Y, unsigned ld) {
+  constexpr unsigned KB = 64;
+  for (unsigned p0 = 0; p0 < k; p0 += KB) {
+    const unsigned p1 = std::min(k, p0 + KB);
+    for (unsigned i = 0; i < m; ++i) {
+      const T* a = A + std::size_t(i) * k;
+      T* y = Y + std::size_t(i) * ld;
+      for (unsigned p = p0; p < p1; ++p) {
+        const T a_ip = a[p];
+        const T* x = X + std::size_t(p) * ld;
+        for (unsigned j = 0; j < n; ++j)
+          y[j] += a_ip * x[j];
+      }
+    }
+  }
+}
+
+/** Default: the expansion has no M2L_matrix, nothing is batched */
+template <typename Context,
+          bool = ExpansionTraits<typename Context::expansion_type>
+                 ::has_matrix_M2L>
+class MatrixM2L {
+ public:
+  bool build(Context&, const InteractionList&) {
+    return false;
+  }
+  void execute(Context&) {}
+};
+
+/** The M2L pairs of an interaction list grouped by translation */
+template <typename Context>
+class MatrixM2L<Context, true> {
+  typedef typename Context::expansion_type              expansion_type;
+  typedef ExpansionTraits<expansion_type>               expansion_traits;
+  typedef typename expansion_traits::point_type         point_type;
+  typedef typename expansion_traits::multipole_coefficient_type
+      coefficient_type;
+
+  static const unsigned D = expansion_traits::dimension;
+
+  //! The number of expansions packed into a GEMM
+  static constexpr unsigned block_size = 64;
+
+  //! Offsets of each group into pairs_
+  std::vector<unsigned> group_ptr_;
+  //! The (source box index, target box index) pairs ordered by group
+  std::vector<std::pair<unsigned,unsigned> > pairs_;
+  //! The translation of each group
+  std::vector<point_type> translation_;
+
+  //! The operators of the groups, computed on the first execute
+  std::vector<coefficient_type> matrices_;
+  //! Offsets of each group into matrices_ and the size of its operator
+  std::vector<std::size_t> matrix_ptr_;
+  std::vector<unsigned> rows_, cols_;
+
+  template <typename Expansion>
+  static unsigned size(const Expansion& E) {
+    return std::distance(std::begin(E), std::end(E));
+  }
+
+  void init_matrices(Context& c) {
+    const unsigned num_groups = translation_.size();
+    rows_.resize(num_groups);
+    cols_.resize(num_groups);
+    matrix_ptr_.assign(1, 0);
+    for (unsigned g = 0; g < num_groups; ++g) {
+      const auto& pair = pairs_[group_ptr_[g]];
+      rows_[g] = size(c.local(c.target_tree().box(pair.second)));
+      cols_[g] = size(c.multipole(c.source_tree().box(pair.first)));
+      matrix_ptr_.push_back(matrix_ptr_.back() + rows_[g] * cols_[g]);
+    }
+    matrices_.assign(matrix_ptr_.back(), coefficient_type());
+
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned g = 0; g < num_groups; ++g)
+      c.expansion().M2L_matrix(translation_[g],
+                               matrices_.data() + matrix_ptr_[g]);
+  }
+
+ public:
+  /** Group the pairs of @a list by translation
+   * @returns Whether all translations are on the lattice of the trees.
+   *          If not, nothing is grouped and the pairs should be evaluated
+   *          one at a time.
+   */
+  bool build(Context& c, const InteractionList& list) {
+    std::unordered_map<TranslationKey<D>, unsigned, TranslationKeyHash> group;
+    std::vector<std::pair<unsigned,unsigned> > pairs;
+    std::vector<unsigned> pair_group;
+
+    translation_.clear();
+    for (unsigned t : list.targets()) {
+      auto tb = c.target_tree().box(t);
+      auto e_end = list.end(t);
+      for (auto ei = list.begin(t); ei != e_end; ++ei) {
+        const unsigned s_last = InteractionList::last(*ei);
+        for (unsigned s = InteractionList::first(*ei); s != s_last; ++s) {
+          auto sb = c.source_tree().box(s);
+          TranslationKey<D> key;
+          if (!translation_key<D>(sb, tb, key)) {
+            translation_.clear();
+            return false;
+          }
+          auto ins = group.emplace(key, unsigned(translation_.size()));
+          if (ins.second)
+            translation_.push_back(tb.center() - sb.center());
+          pair_group.push_back(ins.first->second);
+          pairs.emplace_back(s, t);
+        }
+      }
+    }
+
+    // Bucket the pairs by group
+    group_ptr_.assign(translation_.size() + 1, 0);
+    for (unsigned g : pair_group)
+      ++group_ptr_[g+1];
+    for (unsigned g = 1; g < group_ptr_.size(); ++g)
+      group_ptr_[g] += group_ptr_[g-1];
+    std::vector<unsigned> fill(group_ptr_.begin(), group_ptr_.end() - 1);
+    pairs_.resize(pairs.size());
+    for (unsigned k = 0; k < pairs.size(); ++k)
+      pairs_[fill[pair_group[k]]++] = pairs[k];
+
+    matrices_.clear();
+    return true;
+  }
+
+  /** Accumulate the M2L of all grouped pairs into the local expansions
+   * @pre build(c, list) returned true
+   */
+  void execute(Context& c) {
+    if (pairs_.empty())
+      return;
+    if (matrices_.empty())
+      init_matrices(c);
+
+    const unsigned num_groups = translation_.size();
+
+#pragma omp parallel
+    {
+      std::vector<coefficient_type> X, Y;
+      unsigned targets[block_size];
+
+      for (unsigned g = 0; g < num_groups; ++g) {
+        const unsigned m = rows_[g];
+        const unsigned k = cols_[g];
+        const coefficient_type* A = matrices_.data() + matrix_ptr_[g];
+        X.resize(std::max<std::size_t>(X.size(), k * block_size));
+        Y.resize(std::max<std::size_t>(Y.size(), m * block_size));
+
+        // Each target box occurs at most once in a group
+        const unsigned p_end = group_ptr_[g+1];
+#pragma omp for schedule(static)
+        for (unsigned b = group_ptr_[g]; b < p_end; b += block_size) {
+          // Pack the charged multipoles as the columns of X
+          const unsigned b_end = std::min(b + block_size, p_end);
+          unsigned n = 0;
+          for (unsigned p = b; p != b_end; ++p) {
+            auto sb = c.source_tree().box(pairs_[p].first);
+            if (!c.is_charged(sb))
+              continue;
+            coefficient_type* x = X.data() + n;
+            for (auto&& M_i : c.multipole(sb)) {
+              *x = M_i;
+              x += block_size;
+            }
+            targets[n++] = pairs_[p].second;
+          }
+          if (n == 0)
+            continue;
+
+          std::fill(Y.begin(), Y.begin() + m * block_size, coefficient_type());
+          gemm_acc(m, k, n, A, X.data(), Y.data(), block_size);
+
+          // Unpack the columns of Y into the locals
+          for (unsigned j = 0; j != n; ++j) {
+            const coefficient_type* y = Y.data() + j;
+            for (auto&& L_i : c.local(c.target_tree().box(targets[j]))) {
+              L_i += *y;
+              y += block_size;
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+} // end namespace fmmtl
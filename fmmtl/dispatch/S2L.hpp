@@ -93,6 +93,9 @@ struct S2L {
                           const typename Context::source_box_type& sbox,
                           const typename Context::target_box_type& tbox)
   {
+    if (!c.is_charged(sbox))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "S2L:"
               << "\n  " << sbox
@@ -39,8 +39,7 @@ struct S2M_Helper<true> {
   /** The Expansion provides a scalar S2M accumulator. */
   template <typename Expansion>
   inline static
-  typename std::enable_if<ExpansionTraits<Expansion>::has_scalar_S2M &
-                          !ExpansionTraits<Expansion>::has_vector_S2M>::type
+  typename std::enable_if<ExpansionTraits<Expansion>::has_scalar_S2M>::type
   apply(const Expansion& K,
         const typename Expansion::source_type& source,
         const typename Expansion::charge_type& charge,
@@ -49,6 +48,19 @@ struct S2M_Helper<true> {
     K.S2M(source, charge, center, M);
   }
 
+  /** The Expansion provides only a vector S2M accumulator. */
+  template <typename Expansion>
+  inline static
+  typename std::enable_if<!ExpansionTraits<Expansion>::has_scalar_S2M &
+                          ExpansionTraits<Expansion>::has_vector_S2M>::type
+  apply(const Expansion& K,
+        const typename Expansion::source_type& source,
+        const typename Expansion::charge_type& charge,
+        const typename Expansion::point_type& center,
+        typename Expansion::multipole_type& M) {
+    K.S2M(&source, &source + 1, &charge, center, M);
+  }
+
   /** The Expansion provides a scalar S2M accumulator. */
   template <typename Expansion, typename SourceIter, typename ChargeIter>
   inline static
@@ -91,6 +103,10 @@ struct S2M {
   inline static void eval(Context& c,
                           const typename Context::source_box_type& sbox)
   {
+    // The multipole of a box without charge stays zero
+    if (!c.is_charged(sbox))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "S2M:"
               << "\n  " << sbox << std::endl;
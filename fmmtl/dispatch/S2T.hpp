@@ -4,21 +4,21 @@
  *
  */
 
+#include <algorithm>
 #include <iterator>
 #include <type_traits>
+#include <vector>
 
 #include "fmmtl/util/Logger.hpp"
+#include "fmmtl/util/AlignedAllocator.hpp"
 #include "fmmtl/meta/kernel_traits.hpp"
 
 #if !defined(P2P_BLOCK_SIZE)
 #  define P2P_BLOCK_SIZE 128
 #endif
-#if !defined(P2P_NUM_THREADS)
-#  define P2P_NUM_THREADS std::thread::hardware_concurrency()
-#endif
 
 // Definition of direct block-evaluation schemes
-// TODO: Parallel dispatching option, trivial iterator detection
+// TODO: Parallel dispatching option
 namespace fmmtl {
 namespace detail {
 
@@ -53,11 +53,36 @@ symm_eval(const Kernel& K,
   r2 += K.transpose(k12) * c1;
 }
 
+/** True if Iter is a pointer or a std::vector iterator */
+template <typename Iter>
+struct is_contiguous_iterator {
+  typedef typename std::iterator_traits<Iter>::value_type value_type;
+  typedef typename std::vector<value_type>::iterator       vec_iterator;
+  typedef typename std::vector<value_type>::const_iterator vec_const_iterator;
+  static const bool value = std::is_pointer<Iter>::value ||
+      std::is_same<Iter, vec_iterator>::value ||
+      std::is_same<Iter, vec_const_iterator>::value;
+};
+
+/** True if the asymmetric block evaluation can use K.batch */
+template <typename Kernel, typename SourceIter, typename ChargeIter>
+struct use_batch {
+  typedef KernelTraits<Kernel> traits;
+  static const bool value = traits::has_batch &&
+      is_contiguous_iterator<SourceIter>::value &&
+      is_contiguous_iterator<ChargeIter>::value &&
+      std::is_same<typename std::iterator_traits<SourceIter>::value_type,
+                   typename traits::source_type>::value &&
+      std::is_same<typename std::iterator_traits<ChargeIter>::value_type,
+                   typename traits::charge_type>::value;
+};
+
 /** Asymmetric block P2P evaluation */
 template <typename Kernel,
           typename SourceIter, typename ChargeIter,
           typename TargetIter, typename ResultIter>
-inline void
+inline
+typename std::enable_if<!use_batch<Kernel,SourceIter,ChargeIter>::value>::type
 block_eval(const Kernel& K,
            SourceIter s_first, SourceIter s_last, ChargeIter c_first,
            TargetIter t_first, TargetIter t_last, ResultIter r_first)
@@ -78,6 +103,30 @@ block_eval(const Kernel& K,
   }
 }
 
+/** Asymmetric block P2P evaluation with the kernel's batch operator
+ * over contiguous sources and charges.
+ * The batch operator excludes self interactions with a mask rather than a
+ * branch, so its inner loop over the sources is vectorized.
+ */
+template <typename Kernel,
+          typename SourceIter, typename ChargeIter,
+          typename TargetIter, typename ResultIter>
+inline
+typename std::enable_if<use_batch<Kernel,SourceIter,ChargeIter>::value>::type
+block_eval(const Kernel& K,
+           SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first)
+{
+  const unsigned n = s_last - s_first;
+  if (n == 0)
+    return;
+  const auto* s = &*s_first;
+  const auto* c = &*c_first;
+
+  for ( ; t_first != t_last; ++t_first, ++r_first)
+    K.batch(*t_first, s, c, n, *r_first);
+}
+
 /** Symmetric off-diagonal block P2P evaluation */
 template <typename Kernel,
           typename SourceIter, typename ChargeIter,
@@ -156,6 +205,127 @@ block_eval(const Kernel& K,
 
 
 
+/** Default behavior: the kernel has no SoA batch operator */
+template <bool has_soa_batch>
+struct S2T_SoA_Helper {
+  template <typename Context, typename SourceBox, typename TargetBox>
+  inline static bool eval(Context&, const SourceBox&, const SourceBox&,
+                          const TargetBox&) {
+    return false;
+  }
+};
+
+/** The kernel consumes the SoA views of the context, if it has them */
+template <>
+struct S2T_SoA_Helper<true> {
+  template <typename Context, typename SourceBox, typename TargetBox>
+  inline static bool eval(Context& c,
+                          const SourceBox& sfirst, const SourceBox& slast,
+                          const TargetBox& target) {
+    if (!c.has_soa())
+      return false;
+
+    const auto& K = c.kernel();
+    const auto s = c.source_soa(sfirst, slast);
+    const auto q = c.charge_soa(sfirst, slast);
+    auto ri = c.result_begin(target);
+    auto t_end = c.target_end(target);
+    for (auto ti = c.target_begin(target); ti != t_end; ++ti, ++ri)
+      K.batch(*ti, s, q, *ri);
+    return true;
+  }
+};
+
+/** Default behavior: the kernel has no mixed-precision batch operator */
+template <bool has_mixed_batch>
+struct S2T_Mixed_Helper {
+  template <typename Context, typename SourceBox, typename TargetBox>
+  inline static bool eval(Context&, const SourceBox&, const SourceBox&,
+                          const TargetBox&) {
+    return false;
+  }
+};
+
+/** Evaluate the kernel in float on coordinates relative to the target leaf.
+ *
+ * The sources and targets are shifted to a common origin, the center of the
+ * target box, so that only offsets of the size of the near field are
+ * rounded to float. The kernel sums tiles of P2P_BLOCK_SIZE sources in
+ * float, which are accumulated into the double results. The converted
+ * bodies are staged in padded per-thread SoA buffers.
+ */
+template <>
+struct S2T_Mixed_Helper<true> {
+  template <typename Context, typename SourceBox, typename TargetBox>
+  inline static bool eval(Context& c,
+                          const SourceBox& sfirst, const SourceBox& slast,
+                          const TargetBox& target) {
+    if (!c.mixed_precision())
+      return false;
+
+    typedef KernelTraits<typename Context::kernel_type> kernel_traits;
+    typedef typename kernel_traits::source_type       source_type;
+    typedef typename kernel_traits::target_type       target_type;
+    typedef typename kernel_traits::charge_type       charge_type;
+    typedef typename kernel_traits::source_float_type source_float_type;
+    typedef typename kernel_traits::target_float_type target_float_type;
+    typedef typename kernel_traits::charge_float_type charge_float_type;
+    typedef fmmtl::soa_traits<source_type> s_traits;
+    typedef fmmtl::soa_traits<target_type> t_traits;
+    typedef fmmtl::soa_traits<charge_type> c_traits;
+
+    auto t_first = c.target_begin(target);
+    auto t_last  = c.target_end(target);
+    auto s_first = c.source_begin(sfirst);
+    const std::size_t n = c.source_end(slast) - s_first;
+    if (t_first == t_last || n == 0)
+      return true;
+    const target_type origin = target.center();
+
+    // Pad to a multiple of the float vector width
+    const std::size_t W  = 2 * FMMTL_SIMD_WIDTH;
+    const std::size_t np = (n + W - 1) / W * W;
+
+    static thread_local
+        std::vector<float, fmmtl::aligned_allocator<float> > s_buf;
+    static thread_local
+        std::vector<float, fmmtl::aligned_allocator<float> > q_buf;
+    s_buf.resize(s_traits::components * np);
+    q_buf.resize(c_traits::components * np);
+
+    auto ci = c.charge_begin(sfirst);
+    for (std::size_t k = 0; k < np; ++k) {
+      // Padding repeats the last source with no charge
+      const source_type& s = s_first[k < n ? k : n-1];
+      for (std::size_t d = 0; d < s_traits::components; ++d)
+        s_buf[d*np + k] = float(s_traits::get(s, d) -
+                                t_traits::get(origin, d));
+      for (std::size_t d = 0; d < c_traits::components; ++d)
+        q_buf[d*np + k] = (k < n) ? float(c_traits::get(ci[k], d)) : 0.0f;
+    }
+
+    static thread_local std::vector<target_float_type> t_buf;
+    t_buf.resize(t_last - t_first);
+    for (std::size_t i = 0; i < t_buf.size(); ++i)
+      for (std::size_t d = 0; d < t_traits::components; ++d)
+        t_buf[i][d] = float(t_traits::get(t_first[i], d) -
+                            t_traits::get(origin, d));
+
+    // The kernel sums each tile in float, the tiles are summed in double
+    const std::size_t tile = std::max<std::size_t>(W, P2P_BLOCK_SIZE / W * W);
+    const auto& K = c.kernel();
+    for (std::size_t j = 0; j < np; j += tile) {
+      const std::size_t nj = std::min(tile, np - j);
+      const fmmtl::SoAView<source_float_type> s_view = {&s_buf[j], np, nj};
+      const fmmtl::SoAView<charge_float_type> q_view = {&q_buf[j], np, nj};
+      auto ri = c.result_begin(target);
+      for (std::size_t i = 0; i < t_buf.size(); ++i, ++ri)
+        K.batch(t_buf[i], s_view, q_view, *ri);
+    }
+    return true;
+  }
+};
+
 // TODO: namespace and fix
 
 struct S2T {
@@ -175,6 +345,9 @@ struct S2T {
                           const typename Context::target_box_type& target,
                           const ONE_SIDED&)
   {
+    if (!c.is_charged(source))
+      return;
+
 #if defined(FMMTL_DEBUG)
     std::cout << "S2T:"
               << "\n  " << source
@@ -182,6 +355,14 @@ struct S2T {
 #endif
     FMMTL_LOG("S2T 2box asymm");
 
+    typedef KernelTraits<typename Context::kernel_type> kernel_traits;
+    if (S2T_Mixed_Helper<kernel_traits::has_mixed_batch>::eval(c, source,
+                                                               source, target))
+      return;
+    if (S2T_SoA_Helper<kernel_traits::has_soa_batch>::eval(c, source, source,
+                                                           target))
+      return;
+
     fmmtl::detail::block_eval(c.kernel(),
                               c.source_begin(source), c.source_end(source),
                               c.charge_begin(source),
@@ -189,6 +370,39 @@ struct S2T {
                               c.result_begin(target));
   }
 
+  /** Asymmetric S2T from a run of source boxes with contiguous bodies
+   * @pre The bodies of @a sfirst through @a slast are contiguous
+   */
+  template <typename Context>
+  inline static void eval(Context& c,
+                          const typename Context::source_box_type& sfirst,
+                          const typename Context::source_box_type& slast,
+                          const typename Context::target_box_type& target,
+                          const ONE_SIDED&)
+  {
+#if defined(FMMTL_DEBUG)
+    std::cout << "S2T:"
+              << "\n  " << sfirst
+              << "\n  " << slast
+              << "\n  " << target << std::endl;
+#endif
+    FMMTL_LOG("S2T 2box asymm");
+
+    typedef KernelTraits<typename Context::kernel_type> kernel_traits;
+    if (S2T_Mixed_Helper<kernel_traits::has_mixed_batch>::eval(c, sfirst,
+                                                               slast, target))
+      return;
+    if (S2T_SoA_Helper<kernel_traits::has_soa_batch>::eval(c, sfirst, slast,
+                                                           target))
+      return;
+
+    fmmtl::detail::block_eval(c.kernel(),
+                              c.source_begin(sfirst), c.source_end(slast),
+                              c.charge_begin(sfirst),
+                              c.target_begin(target), c.target_end(target),
+                              c.result_begin(target));
+  }
+
   /** Symmetric S2T
    */
   template <typename Context>
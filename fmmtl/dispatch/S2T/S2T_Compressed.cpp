@@ -1,41 +1,149 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
 
 #include "fmmtl/dispatch/S2T/S2T_Compressed.hpp"
+#include "fmmtl/dispatch/S2T.hpp"
+
+/** Host data of the CPU S2T_Compressed */
+struct HostData {
+  unsigned num_sources;
+  unsigned num_targets;
+  unsigned num_blocks;
+  //! The cumulative kernel evaluations of the target ranges, nnz[0] = 0
+  std::vector<double> nnz;
+  HostData(unsigned s, unsigned t, unsigned b)
+      : num_sources(s),
+        num_targets(t),
+        num_blocks(b),
+        nnz(b+1, 0) {
+  }
+};
+
+template <typename T>
+inline T* host_copy(const std::vector<T>& v) {
+  T* p = new T[v.size()];
+  std::copy(v.begin(), v.end(), p);
+  return p;
+}
 
 template <typename Kernel>
-S2T_Compressed<Kernel>::S2T_Compressed() {
+S2T_Compressed<Kernel>::S2T_Compressed()
+    : data_(0),
+      target_ranges_(0),
+      source_range_ptrs_(0),
+      source_ranges_(0),
+      sources_(0),
+      targets_(0) {
 }
 
 template <typename Kernel>
 S2T_Compressed<Kernel>::S2T_Compressed(
-    std::vector<std::pair<unsigned,unsigned> >&,
-    std::vector<unsigned>&,
-    std::vector<std::pair<unsigned,unsigned> >&,
-    const std::vector<source_type>&,
-    const std::vector<target_type>&) {
+    std::vector<std::pair<unsigned,unsigned> >& target_ranges,
+    std::vector<unsigned>& source_range_ptrs,
+    std::vector<std::pair<unsigned,unsigned> >& source_ranges,
+    const std::vector<source_type>& sources,
+    const std::vector<target_type>& targets)
+    : data_(new HostData(sources.size(), targets.size(), target_ranges.size())),
+      target_ranges_(host_copy(target_ranges)),
+      source_range_ptrs_(host_copy(source_range_ptrs)),
+      source_ranges_(host_copy(source_ranges)),
+      sources_(host_copy(sources)),
+      targets_(host_copy(targets)) {
+  // Count the kernel evaluations of each target range to balance the threads
+  HostData* data = reinterpret_cast<HostData*>(data_);
+  for (unsigned k = 0; k < target_ranges.size(); ++k) {
+    double num_sources = 0;
+    for (unsigned j = source_range_ptrs[k]; j < source_range_ptrs[k+1]; ++j)
+      num_sources += source_ranges[j].second - source_ranges[j].first;
+    const double num_targets =
+        target_ranges[k].second - target_ranges[k].first;
+    data->nnz[k+1] = data->nnz[k] + num_targets * num_sources;
+  }
 }
 
 template <typename Kernel>
 S2T_Compressed<Kernel>::~S2T_Compressed() {
-  // TODO: delete
+  delete reinterpret_cast<HostData*>(data_);
+  delete[] target_ranges_;
+  delete[] source_range_ptrs_;
+  delete[] source_ranges_;
+  delete[] sources_;
+  delete[] targets_;
 }
 
 template <typename Kernel>
 void S2T_Compressed<Kernel>::execute(
-    const Kernel&,
-    const std::vector<charge_type>&,
-    std::vector<result_type>&) {
-  std::cerr << "ERROR: Calling unimplemented S2T_compressed CPU" << std::endl;
+    const Kernel& K,
+    const std::vector<charge_type>& charges,
+    std::vector<result_type>& results) {
+  const HostData* data = reinterpret_cast<const HostData*>(data_);
+  const std::vector<double>& nnz = data->nnz;
+  const unsigned num_blocks = data->num_blocks;
+
+  const charge_type* c = charges.data();
+  result_type* r = results.data();
+
+#pragma omp parallel
+  {
+    // Each thread takes a contiguous chunk of the (disjoint) target ranges
+    // with an equal share of the kernel evaluations
+    const unsigned P = omp_get_num_threads();
+    const unsigned p = omp_get_thread_num();
+    const double total = nnz[num_blocks];
+    const unsigned k_begin = std::lower_bound(nnz.begin(),
+                                              nnz.begin() + num_blocks,
+                                              total * p / P) - nnz.begin();
+    const unsigned k_end = (p+1 == P) ? num_blocks :
+        std::lower_bound(nnz.begin(), nnz.begin() + num_blocks,
+                         total * (p+1) / P) - nnz.begin();
+
+    for (unsigned k = k_begin; k < k_end; ++k) {
+      const unsigned i_begin = target_ranges_[k].first;
+      const unsigned i_end   = target_ranges_[k].second;
+
+      for (unsigned sr = source_range_ptrs_[k];
+           sr < source_range_ptrs_[k+1]; ++sr) {
+        const unsigned j_end = source_ranges_[sr].second;
+
+        // Sweep the targets with a tile of sources that stays in cache
+        for (unsigned j = source_ranges_[sr].first; j < j_end;
+             j += P2P_BLOCK_SIZE) {
+          const unsigned j_tile = std::min(j + P2P_BLOCK_SIZE, j_end);
+          fmmtl::detail::block_eval(K,
+                                    sources_ + j, sources_ + j_tile, c + j,
+                                    targets_ + i_begin, targets_ + i_end,
+                                    r + i_begin);
+        }
+      }
+    }
+  }
 }
 
 template <typename Kernel>
 void S2T_Compressed<Kernel>::execute(
-    const Kernel&,
-    const std::vector<source_type>&,
-    const std::vector<charge_type>&,
-    const std::vector<target_type>&,
-    std::vector<result_type>&) {
-  std::cerr << "ERROR: Calling unimplemented S2T_compressed CPU" << std::endl;
+    const Kernel& K,
+    const std::vector<source_type>& s,
+    const std::vector<charge_type>& c,
+    const std::vector<target_type>& t,
+    std::vector<result_type>& r) {
+  const unsigned num_sources = s.size();
+  const int num_blocks = (t.size() + P2P_BLOCK_SIZE - 1) / P2P_BLOCK_SIZE;
+
+#pragma omp parallel for
+  for (int b = 0; b < num_blocks; ++b) {
+    const unsigned i_begin = b * P2P_BLOCK_SIZE;
+    const unsigned i_end = std::min<unsigned>(i_begin + P2P_BLOCK_SIZE,
+                                              t.size());
+
+    for (unsigned j = 0; j < num_sources; j += P2P_BLOCK_SIZE) {
+      const unsigned j_tile = std::min<unsigned>(j + P2P_BLOCK_SIZE,
+                                                 num_sources);
+      fmmtl::detail::block_eval(K,
+                                s.data() + j, s.data() + j_tile, c.data() + j,
+                                t.data() + i_begin, t.data() + i_end,
+                                r.data() + i_begin);
+    }
+  }
 }
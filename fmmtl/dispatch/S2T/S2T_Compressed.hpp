@@ -153,48 +153,49 @@ class S2T_Compressed {
   }
 
 
-  template <class Context>
+  /** Construct a S2T_Compressed object from the InteractionList of a
+   * BatchNear, whose entries are runs of source boxes with contiguous bodies.
+   */
+  template <class Context, class List>
   static
   S2T_Compressed<typename Context::kernel_type>*
-  make(Context& c,
-       const std::vector<typename Context::target_box_type> t_boxes,
-       const std::vector<std::vector<typename Context::source_box_type> > s_boxes,
-       int num_box_pairs) {
+  make(Context& c, const List& list) {
     typedef typename Context::target_box_type target_box_type;
     typedef typename Context::source_box_type source_box_type;
 
     typedef std::pair<unsigned, unsigned> upair;
 
-    // Interaction list for each target box
-    // (target_first,target_last) -> {(source_first, source_last), ...}
-
     typename Context::source_iterator first_source = c.source_begin();
     typename Context::target_iterator first_target = c.target_begin();
 
+    const std::vector<typename List::index_type>& t_boxes = list.targets();
+
     std::vector<upair> target_ranges;
     target_ranges.reserve(t_boxes.size());
     std::vector<unsigned> target_ptr;
-    target_ptr.reserve(num_box_pairs+1);
+    target_ptr.reserve(t_boxes.size()+1);
     std::vector<upair> source_ranges;
-    source_ranges.reserve(num_box_pairs);
+    source_ranges.reserve(list.entries());
 
     // Construct a compressed interaction list
     target_ptr.push_back(0);
     for (unsigned k = 0; k < t_boxes.size(); ++k) {
       // Copy the source ranges that interact with the kth target range
-      const target_box_type& t = t_boxes[k];
+      const target_box_type t = c.target_tree().box(t_boxes[k]);
       target_ranges.push_back(upair(std::distance(first_target, c.target_begin(t)),
                                     std::distance(first_target, c.target_end(t))));
 
-      const std::vector<source_box_type>& s_list = s_boxes[t.index()];
-      for (unsigned n = 0; n < s_list.size(); ++n) {
-        const source_box_type& s = s_list[n];
-        source_ranges.push_back(upair(std::distance(first_source, c.source_begin(s)),
-                                      std::distance(first_source, c.source_end(s))));
+      typename List::entry_iterator ei = list.begin(t_boxes[k]);
+      typename List::entry_iterator e_end = list.end(t_boxes[k]);
+      for ( ; ei != e_end; ++ei) {
+        const source_box_type sfirst = c.source_tree().box(List::first(*ei));
+        const source_box_type slast = c.source_tree().box(List::last(*ei) - 1);
+        source_ranges.push_back(upair(std::distance(first_source, c.source_begin(sfirst)),
+                                      std::distance(first_source, c.source_end(slast))));
       }
 
       // Record the stop index
-      target_ptr.push_back(std::distance(source_ranges.begin(), source_ranges.end()));
+      target_ptr.push_back(source_ranges.size());
     }
 
     // Sanity checking
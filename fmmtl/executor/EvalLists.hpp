@@ -9,6 +9,7 @@
 #include "fmmtl/dispatch/Dispatchers.hpp"
 #include "fmmtl/tree/TreeRange.hpp"
 #include "fmmtl/meta/kernel_traits.hpp"
+#include "fmmtl/util/MemoryUsage.hpp"
 
 
 template <class Context>
@@ -18,15 +19,40 @@ class EvalLists
   typedef typename Context::source_box_type source_box;
   typedef typename Context::target_box_type target_box;
 
+  typedef ExpansionTraits<typename Context::expansion_type> expansion_traits;
+
   BatchNear<Context> near_batch_;
   BatchFar<Context> far_batch_;
 
+  //! Whether the multipole of each source box by index is used
+  std::vector<char> m_live_;
+  //! Whether the local of each target box by index is used
+  std::vector<char> l_live_;
+
+  //! Whether to use the cache-blocked tree passes
+  bool blocked_;
+  //! Cache-sized subtrees of the source and target trees
+  SubtreeBlocks<typename Context::source_tree_type> up_blocks_;
+  SubtreeBlocks<typename Context::target_tree_type> down_blocks_;
+
+  /** Flag the descendants of the flagged boxes of @a tree */
+  template <class Tree>
+  static void flag_descendants(const Tree& tree, std::vector<char>& flag) {
+    // Box indices are ordered by level, the root is box 0
+    for (unsigned k = 1; k < tree.boxes(); ++k)
+      flag[k] |= flag[tree.box(k).parent().index()];
+  }
+
   struct UpDispatch {
     Context& c_;
-    UpDispatch(Context& c) : c_(c) {}
+    const std::vector<char>& live_;
+    UpDispatch(Context& c, const std::vector<char>& live)
+        : c_(c), live_(live) {}
 
     inline void operator()(const source_box& box) {
-      if (ExpansionTraits<typename Context::expansion_type>::has_M2M) {
+      if (!live_[box.index()])
+        return;
+      if (expansion_traits::has_M2M) {
         if (box.is_leaf()) {
           // If leaf, make S2M calls
           S2M::eval(c_, box);
@@ -43,10 +69,14 @@ class EvalLists
   };
   struct DownDispatch {
     Context& c_;
-    DownDispatch(Context& c) : c_(c) {}
+    const std::vector<char>& live_;
+    DownDispatch(Context& c, const std::vector<char>& live)
+        : c_(c), live_(live) {}
 
     inline void operator()(const target_box& box) {
-      if (ExpansionTraits<typename Context::expansion_type>::has_L2L) {
+      if (!live_[box.index()])
+        return;
+      if (expansion_traits::has_L2L) {
         if (box.is_leaf()) {
           // If leaf, make L2T calls
           L2T::eval(c_, box);
@@ -62,49 +92,127 @@ class EvalLists
     }
   };
 
- public:
+  /** Computes the multipole of a box from its children or sources */
+  struct BlockedUpDispatch {
+    Context& c_;
+    const std::vector<char>& live_;
+    BlockedUpDispatch(Context& c, const std::vector<char>& live)
+        : c_(c), live_(live) {}
+
+    inline void operator()(const source_box& box) {
+      if (!live_[box.index()])
+        return;
+      INITM::eval(c_, box);
+      UpDispatch up(c_, live_);
+      up(box);
+    }
+  };
+  /** Computes the local of a box from its far field and its parent,
+   * then its results if it is a leaf */
+  struct BlockedDownDispatch {
+    Context& c_;
+    BatchFar<Context>& far_;
+    const std::vector<char>& live_;
+    BlockedDownDispatch(Context& c, BatchFar<Context>& far,
+                        const std::vector<char>& live)
+        : c_(c), far_(far), live_(live) {}
 
-  EvalLists(Context& c) {
-    // Construct functors for dispatched near and far operators
-    auto far_batcher = [&c,this](const source_box& s, const target_box& t) {
-      if (MAC::eval(c,s,t)) {
-        far_batch_.insert(s,t);
-        return true;
+    inline void operator()(const target_box& box) {
+      if (!live_[box.index()])
+        return;
+      INITL::eval(c_, box);
+      far_.execute(c_, box);
+      if (expansion_traits::has_L2L) {
+        if (box.level() != 0 && live_[box.parent().index()])
+          L2L::eval(c_, box.parent(), box);
+        if (box.is_leaf())
+          L2T::eval(c_, box);
+      } else {
+        // Rely solely on L2T
+        L2T::eval(c_, box);
       }
-      return false;
-    };
-    auto near_batcher = [this](const source_box& s, const target_box& t) {
-      near_batch_.insert(s,t);
-    };
+    }
+  };
+
+ public:
+
+  template <class Options>
+  EvalLists(Context& c, Options& opts)
+      : blocked_(opts.cache_size > 0) {
     // Determine the box interactions
-    fmmtl::traverse_nearfar(c.source_tree().root(), c.target_tree().root(),
-                            near_batcher, far_batcher);
+    build_interaction_lists(c, near_batch_, far_batch_);
+
+    // Precompute the near-field kernel values for repeated executions
+    if (opts.near_matrix > 0)
+      near_batch_.precompute(c, opts.near_matrix);
+    if (opts.near_engine != Options::AUTO)
+      near_batch_.set_engine(opts.near_engine == Options::COMPRESSED);
+
+    if (blocked_) {
+      // Size the subtrees so their expansions fit in the cache
+      auto sroot = c.source_tree().root();
+      auto troot = c.target_tree().root();
+      INITM::eval(c, sroot);
+      INITL::eval(c, troot);
+      std::size_t m_bytes = fmmtl::memory_usage(c.multipole(sroot));
+      std::size_t l_bytes = fmmtl::memory_usage(c.local(troot));
+      up_blocks_ = SubtreeBlocks<typename Context::source_tree_type>(
+          c.source_tree(), std::max<std::size_t>(1, opts.cache_size / m_bytes));
+      down_blocks_ = SubtreeBlocks<typename Context::target_tree_type>(
+          c.target_tree(), std::max<std::size_t>(1, opts.cache_size / l_bytes));
+    }
+
+    // Only store and compute the expansions the far field uses and the
+    // expansions of their descendants, which they are computed from or
+    // pushed down to
+    far_batch_.flag_expansions(c, m_live_, l_live_);
+    if (expansion_traits::has_M2M)
+      flag_descendants(c.source_tree(), m_live_);
+    if (expansion_traits::has_L2L)
+      flag_descendants(c.target_tree(), l_live_);
+    c.restrict_expansions(m_live_, l_live_);
   }
 
   void execute(Context& c) {
     // Launch the p2p early (potentially asynchronously?)
     near_batch_.execute(c);
 
-    // Initialize all the multipoles and locals (not all may be needed)
+    if (blocked_) {
+      // Initialize and compute each multipole and local as part of its
+      // cache-sized subtree.
+      if (expansion_traits::has_S2M) {
+        BlockedUpDispatch up(c, m_live_);
+        BlockedUpwardPass::eval(up_blocks_, up);
+      }
+      if (expansion_traits::has_L2T) {
+        BlockedDownDispatch down(c, far_batch_, l_live_);
+        BlockedDownwardPass::eval(down_blocks_, down);
+      } else {
+        far_batch_.execute(c);
+      }
+      return;
+    }
+
+    // Initialize the used multipoles and locals
     for (auto&& sbox : boxes(c.source_tree()))
-      INITM::eval(c, sbox);
+      if (m_live_[sbox.index()])
+        INITM::eval(c, sbox);
     for (auto&& tbox : boxes(c.target_tree()))
-      INITL::eval(c, tbox);
+      if (l_live_[tbox.index()])
+        INITL::eval(c, tbox);
 
-    // Perform the upward pass (not all may be needed)
-    // TODO: Use far_field batch to only initialize and compute used multipoles
-    if (ExpansionTraits<typename Context::expansion_type>::has_S2M) {
-      UpDispatch up(c);
+    // Perform the upward pass over the used multipoles
+    if (expansion_traits::has_S2M) {
+      UpDispatch up(c, m_live_);
       UpwardPass::eval(c.source_tree(), up);
     }
 
     // Perform the source-target box interactions
     far_batch_.execute(c);
 
-    // Perform the downward pass (not all may be needed)
-    // TODO: Use far_field batch to only initialize and compute used locals
-    if (ExpansionTraits<typename Context::expansion_type>::has_L2T) {
-      DownDispatch down(c);
+    // Perform the downward pass over the used locals
+    if (expansion_traits::has_L2T) {
+      DownDispatch down(c, l_live_);
       DownwardPass::eval(c.target_tree(), down);
     }
   }
@@ -112,6 +220,6 @@ class EvalLists
 
 
 template <class Context, class Options>
-EvaluatorBase<Context>* make_eval_lists(Context& c, Options&) {
-  return new EvalLists<Context>(c);
+EvaluatorBase<Context>* make_eval_lists(Context& c, Options& opts) {
+  return new EvalLists<Context>(c, opts);
 }
@@ -0,0 +1,251 @@
+#pragma once
+/** @file EvalTaskGraph
+ * @brief An interaction-list evaluator that executes the FMM operators as a
+ * dependency graph of tasks rather than as a sequence of global phases.
+ *
+ * Each box contributes a small number of tasks:
+ *   UP(s)    INITM, S2M/M2M of source box s.
+ *              Depends on UP of the children of s.
+ *   FAR(t)   INITL, M2L/S2L/M2T of the far-field list of target box t.
+ *              Depends on UP of the sources in the list of t.
+ *   DOWN(t)  L2L from the parent of t, L2T if t is a leaf.
+ *              Depends on FAR(t), DOWN(parent(t)), and NEAR(t).
+ *   NEAR(t)  S2T of the near-field list of the target leaf t.
+ * Tasks become ready as soon as their dependencies complete, so near-field
+ * work fills the gaps left by the (much less parallel) upward and downward
+ * passes instead of waiting for them behind a barrier.
+ *
+ * Tasks that write to the results of a box are ordered along each root-leaf
+ * path so no two of them may write to the same body concurrently.
+ *
+ * The ready tasks are run by the OpenMP tasking runtime, which balances them
+ * across the threads of the team.
+ */
+
+#include <atomic>
+#include <vector>
+
+#include "fmmtl/executor/Evaluator.hpp"
+
+#include "fmmtl/dispatch/Dispatchers.hpp"
+#include "fmmtl/tree/TreeRange.hpp"
+#include "fmmtl/meta/kernel_traits.hpp"
+
+
+template <class Context>
+class EvalTaskGraph
+    : public EvaluatorBase<Context>
+{
+  typedef typename Context::source_box_type source_box;
+  typedef typename Context::target_box_type target_box;
+
+  typedef ExpansionTraits<typename Context::expansion_type> expansion_traits;
+
+  //! Whether the far field accumulates into local expansions or the results
+  static constexpr bool use_locals = expansion_traits::has_L2T;
+  //! Whether the far field consumes multipole expansions
+  static constexpr bool use_multipoles = expansion_traits::has_S2M &&
+      (expansion_traits::has_M2L || !expansion_traits::has_L2T);
+
+  BatchNear<Context> near_batch_;
+  BatchFar<Context> far_batch_;
+
+  //! The operator a task performs on its box
+  enum TaskType {UP, FAR, DOWN, NEAR};
+
+  struct Task {
+    TaskType type;
+    unsigned box;
+  };
+
+  //! All tasks of the graph
+  std::vector<Task> tasks_;
+  //! Number of dependencies of each task
+  std::vector<unsigned> deps_;
+  //! CSR storage of the successors of each task
+  std::vector<unsigned> next_ptr_;
+  std::vector<unsigned> next_;
+  //! Tasks with no dependencies, the graph's entry points
+  std::vector<unsigned> roots_;
+
+  //! Remaining dependencies of each task during an execution
+  std::vector<std::atomic<unsigned>> pending_;
+
+  //! Task index of the operator on box b, or -1 if there is no such task
+  std::vector<unsigned> up_id_, far_id_, down_id_, near_id_;
+
+  unsigned add_task(TaskType type, unsigned box) {
+    tasks_.push_back(Task{type, box});
+    return tasks_.size() - 1;
+  }
+
+  /** Perform the operators of a task */
+  void run(Context& c, const Task& task) {
+    switch (task.type) {
+      case UP: {
+        source_box sb = c.source_tree().box(task.box);
+        INITM::eval(c, sb);
+        if (expansion_traits::has_M2M && !sb.is_leaf()) {
+          for (auto&& cbox : children(sb))
+            M2M::eval(c, cbox, sb);
+        } else {
+          S2M::eval(c, sb);
+        }
+      } break;
+      case FAR: {
+        target_box tb = c.target_tree().box(task.box);
+        INITL::eval(c, tb);
+        far_batch_.execute(c, tb);
+      } break;
+      case DOWN: {
+        target_box tb = c.target_tree().box(task.box);
+        if (expansion_traits::has_L2L) {
+          if (tb.level() != 0)
+            L2L::eval(c, tb.parent(), tb);
+          if (tb.is_leaf())
+            L2T::eval(c, tb);
+        } else {
+          // Rely solely on L2T
+          L2T::eval(c, tb);
+        }
+      } break;
+      case NEAR: {
+        target_box tb = c.target_tree().box(task.box);
+        near_batch_.execute(c, tb);
+      } break;
+    }
+  }
+
+  /** Run task @a id and any successors that it makes ready */
+  void run_and_release(Context& c, unsigned id) {
+    while (true) {
+      run(c, tasks_[id]);
+
+      // Release the successors, continue with one of them in this thread
+      unsigned next_id = unsigned(-1);
+      for (unsigned k = next_ptr_[id]; k != next_ptr_[id+1]; ++k) {
+        unsigned n = next_[k];
+        if (--pending_[n] == 0) {
+          if (next_id != unsigned(-1))
+            spawn(c, next_id);
+          next_id = n;
+        }
+      }
+      if (next_id == unsigned(-1))
+        return;
+      id = next_id;
+    }
+  }
+
+  void spawn(Context& c, unsigned id) {
+#pragma omp task firstprivate(id) shared(c)
+    run_and_release(c, id);
+  }
+
+ public:
+
+  template <class Options>
+  EvalTaskGraph(Context& c, Options& opts)
+      : up_id_(c.source_tree().boxes(), unsigned(-1)),
+        far_id_(c.target_tree().boxes(), unsigned(-1)),
+        down_id_(c.target_tree().boxes(), unsigned(-1)),
+        near_id_(c.target_tree().boxes(), unsigned(-1)) {
+    // Determine the box interactions
+    build_interaction_lists(c, near_batch_, far_batch_);
+
+    // Precompute the near-field kernel values for repeated executions
+    if (opts.near_matrix > 0)
+      near_batch_.precompute(c, opts.near_matrix);
+    if (opts.near_engine != Options::AUTO)
+      near_batch_.set_engine(opts.near_engine == Options::COMPRESSED);
+
+    // Create the tasks
+    if (use_multipoles)
+      for (auto&& sb : boxes(c.source_tree()))
+        up_id_[sb.index()] = add_task(UP, sb.index());
+    for (auto&& tb : boxes(c.target_tree()))
+      far_id_[tb.index()] = add_task(FAR, tb.index());
+    if (use_locals)
+      for (auto&& tb : boxes(c.target_tree()))
+        down_id_[tb.index()] = add_task(DOWN, tb.index());
+    for (unsigned t : near_batch_.list().targets())
+      near_id_[t] = add_task(NEAR, t);
+
+    // Create the dependencies as (task, successor) pairs
+    std::vector<std::pair<unsigned,unsigned>> edges;
+    if (use_multipoles && expansion_traits::has_M2M) {
+      for (auto&& sb : boxes(c.source_tree()))
+        if (sb.level() != 0)
+          edges.emplace_back(up_id_[sb.index()], up_id_[sb.parent().index()]);
+    }
+    for (auto&& tb : boxes(c.target_tree())) {
+      const unsigned far = far_id_[tb.index()];
+      const unsigned near = near_id_[tb.index()];
+      if (use_multipoles) {
+        auto& far_list = far_batch_.list();
+        auto e_end = far_list.end(tb.index());
+        for (auto ei = far_list.begin(tb.index()); ei != e_end; ++ei)
+          for (unsigned s = far_list.first(*ei); s != far_list.last(*ei); ++s)
+            edges.emplace_back(up_id_[s], far);
+      }
+
+      if (use_locals) {
+        const unsigned down = down_id_[tb.index()];
+        edges.emplace_back(far, down);
+        if (tb.level() != 0)
+          edges.emplace_back(down_id_[tb.parent().index()], down);
+        if (near != unsigned(-1)) {
+          if (expansion_traits::has_L2L)
+            edges.emplace_back(near, down);
+          else   // Every DOWN writes to the results of its box
+            edges.emplace_back(down, near);
+        }
+      } else {
+        // The far field writes directly to the results of the box
+        if (tb.level() != 0)
+          edges.emplace_back(far_id_[tb.parent().index()], far);
+        if (near != unsigned(-1))
+          edges.emplace_back(far, near);
+      }
+    }
+
+    // Compress the dependencies
+    deps_.assign(tasks_.size(), 0);
+    next_ptr_.assign(tasks_.size() + 1, 0);
+    for (auto&& e : edges) {
+      ++next_ptr_[e.first + 1];
+      ++deps_[e.second];
+    }
+    for (unsigned k = 0; k < tasks_.size(); ++k)
+      next_ptr_[k+1] += next_ptr_[k];
+    next_.resize(edges.size());
+    std::vector<unsigned> fill(next_ptr_.begin(), next_ptr_.end() - 1);
+    for (auto&& e : edges)
+      next_[fill[e.first]++] = e.second;
+
+    // Roots in task order: the upward pass first, the near-field last
+    for (unsigned k = 0; k < tasks_.size(); ++k)
+      if (deps_[k] == 0)
+        roots_.push_back(k);
+
+    pending_ = std::vector<std::atomic<unsigned>>(tasks_.size());
+  }
+
+  void execute(Context& c) {
+    for (unsigned k = 0; k < tasks_.size(); ++k)
+      pending_[k] = deps_[k];
+
+#pragma omp parallel
+#pragma omp single
+    {
+      for (unsigned id : roots_)
+        spawn(c, id);
+    }
+  }
+};
+
+
+template <class Context, class Options>
+EvaluatorBase<Context>* make_eval_task_graph(Context& c, Options& opts) {
+  return new EvalTaskGraph<Context>(c, opts);
+}
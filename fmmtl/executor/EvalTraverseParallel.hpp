@@ -0,0 +1,155 @@
+#pragma once
+/** @file EvalTraverseParallel
+ * @brief A parallel evaluator for expansions whose MAC depends on the
+ * expansions themselves, so the interactions cannot be listed in advance.
+ *
+ * The multipoles are completed first. The target tree is partitioned into
+ * disjoint subtrees, each owned by a single thread: the dual traversal is run
+ * serially over the top of the target tree and every box pair whose target
+ * box enters a subtree is deferred to the owner of that subtree. The owners
+ * then continue their traversals in parallel and accumulate only into the
+ * locals and results of their own subtree.
+ */
+
+#include <vector>
+
+#include "fmmtl/executor/Evaluator.hpp"
+
+#include "fmmtl/traversal/Upward.hpp"
+#include "fmmtl/traversal/DualTraversal.hpp"
+#include "fmmtl/traversal/Downward.hpp"
+#include "fmmtl/traversal/SubtreeBlocks.hpp"
+
+#include "fmmtl/dispatch/Dispatchers.hpp"
+#include "fmmtl/tree/TreeRange.hpp"
+#include "fmmtl/meta/kernel_traits.hpp"
+
+
+template <class Context>
+class EvalTraverseParallel
+    : public EvaluatorBase<Context>
+{
+  typedef typename Context::source_box_type source_box;
+  typedef typename Context::target_box_type target_box;
+
+  //! Subtrees of the source tree for the upward pass
+  SubtreeBlocks<typename Context::source_tree_type> up_blocks_;
+  //! Subtrees of the target tree owned by a single thread
+  SubtreeBlocks<typename Context::target_tree_type> down_blocks_;
+
+  //! Whether a target box is in the top of the target tree
+  std::vector<char> in_top_;
+  //! Index of the subtree that owns a target box, if it is a subtree root
+  std::vector<unsigned> owner_;
+
+ public:
+
+  EvalTraverseParallel(Context& c) {
+    // Enough subtrees to balance the threads
+    const std::size_t tasks = 16 * omp_get_max_threads();
+    up_blocks_ = SubtreeBlocks<typename Context::source_tree_type>(
+        c.source_tree(), std::max<std::size_t>(1, c.source_tree().boxes()/tasks));
+    down_blocks_ = SubtreeBlocks<typename Context::target_tree_type>(
+        c.target_tree(), std::max<std::size_t>(1, c.target_tree().boxes()/tasks));
+
+    in_top_.assign(c.target_tree().boxes(), false);
+    for (unsigned L = 0; L < down_blocks_.top_levels(); ++L)
+      for (auto&& tb : down_blocks_.top(L))
+        in_top_[tb.index()] = true;
+    owner_.assign(c.target_tree().boxes(), unsigned(-1));
+    for (unsigned k = 0; k < down_blocks_.subtrees().size(); ++k)
+      owner_[down_blocks_.subtrees()[k].index()] = k;
+  }
+
+  void execute(Context& c) {
+    // Complete the multipoles
+    auto up_dispatch = [&c](const source_box& box) {
+      INITM::eval(c, box);
+      if (box.is_leaf()) {
+        // If leaf, make S2M calls
+        S2M::eval(c, box);
+      } else {
+        // If not leaf, then for all the children M2M
+        auto c_end = box.child_end();
+        for (auto cit = box.child_begin(); cit != c_end; ++cit)
+          M2M::eval(c, *cit, box);
+      }
+    };
+    BlockedUpwardPass::eval(up_blocks_, up_dispatch);
+
+    const unsigned num_tboxes = c.target_tree().boxes();
+#pragma omp parallel for
+    for (unsigned k = 0; k < num_tboxes; ++k)
+      INITL::eval(c, c.target_tree().box(k));
+
+    // Perform the source-target box interactions
+    auto far_dispatch = [&c](const source_box& s, const target_box& t) {
+      if (MAC::eval(c,s,t)) {
+        M2L::eval(c,s,t);
+        return true;
+      }
+      return false;
+    };
+    auto near_dispatch = [&c](const source_box& s, const target_box& t) {
+      S2T::eval(c,s,t,S2T::ONE_SIDED());
+    };
+
+    // Traverse the top of the target tree, deferring the pairs that enter
+    // a subtree to the owner of the subtree
+    auto& roots = down_blocks_.subtrees();
+    std::vector<std::vector<source_box>> deferred(roots.size());
+    traverse_top(c.source_tree().root(), c.target_tree().root(), deferred,
+                 far_dispatch);
+
+    // Each owner completes the traversals within its subtree
+#pragma omp parallel for schedule(dynamic)
+    for (unsigned k = 0; k < roots.size(); ++k)
+      for (auto&& s : deferred[k])
+        fmmtl::traverse_nearfar(s, roots[k], near_dispatch, far_dispatch);
+
+    // Perform the downward pass
+    auto down_dispatch = [&c](const target_box& box) {
+      if (box.level() != 0)
+        L2L::eval(c, box.parent(), box);
+      if (box.is_leaf())
+        L2T::eval(c, box);
+    };
+    BlockedDownwardPass::eval(down_blocks_, down_dispatch);
+  }
+
+ private:
+  /** Traverse the source-target box pair (s,t) like fmmtl::traverse_nearfar
+   * while t is in the top of the target tree. A pair whose target box is the
+   * root of a subtree is deferred to the owner of that subtree.
+   */
+  template <class FarEval>
+  void traverse_top(const source_box& s, const target_box& t,
+                    std::vector<std::vector<source_box>>& deferred,
+                    FarEval& far_eval) const {
+    if (far_eval(s,t))
+      return;
+    if (!in_top_[t.index()]) {
+      deferred[owner_[t.index()]].push_back(s);
+      return;
+    }
+
+    // Boxes in the top of the tree are never leaves, so no pair is near
+    if (!s.is_leaf() && s.volume() > t.volume()) {
+      // Split the source box into children
+      auto c_end = s.child_end();
+      for (auto cit = s.child_begin(); cit != c_end; ++cit)
+        traverse_top(*cit, t, deferred, far_eval);
+    } else {
+      // Split the target box into children
+      auto c_end = t.child_end();
+      for (auto cit = t.child_begin(); cit != c_end; ++cit)
+        traverse_top(s, *cit, deferred, far_eval);
+    }
+  }
+};
+
+
+template <class Context, class Options>
+EvaluatorBase<Context>* make_eval_traverse_parallel(Context& c, Options&) {
+  return new EvalTraverseParallel<Context>(c);
+}
@@ -2,6 +2,8 @@
 
 #include "fmmtl/executor/EvalLists.hpp"
 #include "fmmtl/executor/EvalTraverse.hpp"
+#include "fmmtl/executor/EvalTraverseParallel.hpp"
+#include "fmmtl/executor/EvalTaskGraph.hpp"
 
 #include "fmmtl/meta/kernel_traits.hpp"
 
@@ -13,7 +15,9 @@ EvaluatorBase<Context>* make_evaluator(Context& c, Options& opts) {
 
   // For now
   if (ExpansionTraits<typename Context::expansion_type>::has_dynamic_MAC)
-    return make_eval_traverse(c, opts);
+    return make_eval_traverse_parallel(c, opts);
+  else if (opts.executor == Options::TASK_GRAPH)
+    return make_eval_task_graph(c, opts);
   else
     return make_eval_lists(c, opts);
 }
@@ -9,7 +9,7 @@
 #define HAS_TYPEDEF(NAME, TYPEDEF)                                      \
   template <typename CLASS>                                             \
   struct NAME {                                                         \
-    template <typename U> static char chk(U::TYPEDEF*);                 \
+    template <typename U> static char chk(typename U::TYPEDEF*);        \
     template <typename  > static long chk(...);                         \
     static const bool value = sizeof(chk<CLASS>(0)) == sizeof(char);    \
   }
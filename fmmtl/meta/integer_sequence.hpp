@@ -179,21 +179,20 @@ using idxseq_repeat_t = typename intseq_repeat<N, std::size_t, i>::type;
 // intseq_element
 namespace detail {
 
-template <std::size_t N, typename S = make_index_sequence<N>>
-struct at;
-
-template <std::size_t N, std::size_t... ignore>
-struct at<N, index_sequence<ignore...>> {
-  template <typename Nth>
-  static constexpr Nth apply(decltype(ignore,(void*)0)..., Nth nth, ...)
-  { return nth; }
-};
+template <typename X>
+constexpr X at(std::size_t, X x) {
+  return x;
+}
+template <typename X, typename... Xs>
+constexpr X at(std::size_t n, X x, Xs... xs) {
+  return (n == 0) ? x : at(n-1, xs...);
+}
 
 } // end namespace detail
 
-template <std::size_t N, typename... Xs>
-constexpr auto at(Xs... xs) -> decltype(*detail::at<N>::apply(&xs...)) {
-  return *detail::at<N>::apply(&xs...);
+template <std::size_t N, typename X, typename... Xs>
+constexpr X at(X x, Xs... xs) {
+  return detail::at(N, x, xs...);
 }
 
 template <std::size_t N, typename Seq>
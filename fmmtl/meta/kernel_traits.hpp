@@ -3,8 +3,12 @@
 #include <boost/iterator/iterator_adaptor.hpp>
 
 #include <iostream>
+#include <iterator>
+#include <type_traits>
+#include <utility>
 
 #include "fmmtl/meta/func_traits.hpp"
+#include "fmmtl/util/SoA.hpp"
 
 
 template <typename Kernel>
@@ -29,6 +33,31 @@ struct KernelTraits {
                kernel_value_type, transpose,
                const kernel_value_type&);
   static const bool has_transpose = HasTranspose<Kernel>::value;
+  // Kernel batch evaluation of one target against contiguous sources,
+  // K.batch(t, s, c, n, r) performs r += sum_k K(t,s[k]) * c[k] for k < n
+  HAS_MEM_FUNC(HasBatch,
+               void, batch,
+               const target_type&, const source_type*, const charge_type*,
+               unsigned, result_type&);
+  static const bool has_batch = HasBatch<Kernel>::value;
+  // Kernel batch evaluation of one target against a padded SoA range,
+  // K.batch(t, s, c, r) performs r += sum_k K(t,s[k]) * c[k] for k < s.size()
+  HAS_MEM_FUNC(HasSoABatch,
+               void, batch,
+               const target_type&, const fmmtl::SoAView<source_type>&,
+               const fmmtl::SoAView<charge_type>&, result_type&);
+  static const bool has_soa_batch = HasSoABatch<Kernel>::value;
+  // Mixed-precision batch evaluation of a padded SoA range, K.batch(t, s, c, r)
+  // with t and s in float relative to a nearby origin and c in float
+  typedef typename fmmtl::soa_traits<source_type>::float_type source_float_type;
+  typedef typename fmmtl::soa_traits<target_type>::float_type target_float_type;
+  typedef typename fmmtl::soa_traits<charge_type>::float_type charge_float_type;
+  HAS_MEM_FUNC(HasMixedBatch,
+               void, batch,
+               const target_float_type&,
+               const fmmtl::SoAView<source_float_type>&,
+               const fmmtl::SoAView<charge_float_type>&, result_type&);
+  static const bool has_mixed_batch = HasMixedBatch<Kernel>::value;
 
  protected:
     // A dummy iterator adaptor to check for templated vectorized methods
@@ -56,6 +85,9 @@ struct KernelTraits {
   friend std::ostream& operator<<(std::ostream& s, const self_type& traits) {
     s << "has_eval_op: "           << traits.has_eval_op           << std::endl;
     s << "has_transpose: "         << traits.has_transpose         << std::endl;
+    s << "has_batch: "             << traits.has_batch             << std::endl;
+    s << "has_soa_batch: "         << traits.has_soa_batch         << std::endl;
+    s << "has_mixed_batch: "       << traits.has_mixed_batch       << std::endl;
     s << "has_vector_S2T_symm: "   << traits.has_vector_S2T_symm   << std::endl;
     s << "has_vector_S2T_asymm: "  << traits.has_vector_S2T_asymm;
     return s;
@@ -65,6 +97,29 @@ struct KernelTraits {
 
 #include "fmmtl/meta/dimension.hpp"
 
+/** The type of the precomputed translations of an Expansion, or an empty
+ * placeholder if the Expansion does not define a translation_type */
+template <typename Expansion, bool has_translation_type>
+struct TranslationTypeOf {
+  struct type {};
+};
+template <typename Expansion>
+struct TranslationTypeOf<Expansion, true> {
+  typedef typename Expansion::translation_type type;
+};
+
+/** The type of the coefficients of an expansion: the value type of its
+ * begin() iterator, or the expansion type itself if it is not a range */
+template <typename T, typename = void>
+struct CoefficientOf {
+  typedef T type;
+};
+template <typename T>
+struct CoefficientOf<T, decltype(void(*std::begin(std::declval<T&>())))> {
+  typedef typename std::decay<decltype(*std::begin(std::declval<T&>()))>::type
+      type;
+};
+
 // Expansion traits
 template <typename Expansion>
 struct ExpansionTraits
@@ -149,6 +204,54 @@ struct ExpansionTraits
                const multipole_type&, local_type&, const point_type&);
   static const bool has_M2L = HasM2L<Expansion>::value;
 
+  // M2L as a dense matrix, K.M2L_matrix(r, A) fills the row-major
+  // |L| x |M| matrix A such that L += A * M is the M2L of translation r
+  typedef typename CoefficientOf<multipole_type>::type
+      multipole_coefficient_type;
+  typedef typename CoefficientOf<local_type>::type local_coefficient_type;
+  HAS_MEM_FUNC(HasMatrixM2L,
+               void, M2L_matrix,
+               const point_type&, multipole_coefficient_type*);
+  static const bool has_matrix_M2L =
+      std::is_same<multipole_coefficient_type, local_coefficient_type>::value
+      && HasMatrixM2L<Expansion>::value;
+
+  // Precomputed translations, T = K.make_translation(r) is the data of the
+  // translation r for the M2M, M2L, and L2L operators that accept it
+  HAS_TYPEDEF(HasTranslationType, translation_type);
+  static const bool has_translation_type =
+      HasTranslationType<Expansion>::value;
+  typedef typename TranslationTypeOf<Expansion, has_translation_type>::type
+      translation_type;
+  HAS_MEM_FUNC(HasMakeTranslation,
+               translation_type, make_translation,
+               const point_type&);
+  static const bool has_make_translation =
+      has_translation_type && HasMakeTranslation<Expansion>::value;
+  // T = K.make_translation(r, source_extents, target_extents), for
+  // translations that depend on the sizes of the boxes, is preferred
+  HAS_MEM_FUNC(HasSizedMakeTranslation,
+               translation_type, make_translation,
+               const point_type&, const point_type&, const point_type&);
+  static const bool has_sized_make_translation =
+      has_make_translation && HasSizedMakeTranslation<Expansion>::value;
+  HAS_MEM_FUNC(HasCachedM2M,
+               void, M2M,
+               const multipole_type&, multipole_type&,
+               const translation_type&);
+  static const bool has_cached_M2M =
+      has_make_translation && HasCachedM2M<Expansion>::value;
+  HAS_MEM_FUNC(HasCachedM2L,
+               void, M2L,
+               const multipole_type&, local_type&, const translation_type&);
+  static const bool has_cached_M2L =
+      has_make_translation && HasCachedM2L<Expansion>::value;
+  HAS_MEM_FUNC(HasCachedL2L,
+               void, L2L,
+               const local_type&, local_type&, const translation_type&);
+  static const bool has_cached_L2L =
+      has_make_translation && HasCachedL2L<Expansion>::value;
+
   // MAC
   HAS_MEM_FUNC(HasDynMAC,
                bool, MAC,
@@ -199,7 +302,14 @@ struct ExpansionTraits
     s << "  has_vector_S2L: "   << traits.has_vector_S2L     << std::endl;
     s << "has_M2M: "            << traits.has_M2M            << std::endl;
     s << "has_M2L: "            << traits.has_M2L            << std::endl;
+    s << "  has_matrix_M2L: "   << traits.has_matrix_M2L     << std::endl;
     s << "has_L2L: "            << traits.has_L2L            << std::endl;
+    s << "has_make_translation: " << traits.has_make_translation << std::endl;
+    s << "  has_sized_make_translation: "
+      << traits.has_sized_make_translation << std::endl;
+    s << "  has_cached_M2M: "   << traits.has_cached_M2M     << std::endl;
+    s << "  has_cached_M2L: "   << traits.has_cached_M2L     << std::endl;
+    s << "  has_cached_L2L: "   << traits.has_cached_L2L     << std::endl;
     s << "has_M2T: "            << traits.has_M2T            << std::endl;
     s << "  has_scalar_M2T: "   << traits.has_scalar_M2T     << std::endl;
     s << "  has_vector_M2T: "   << traits.has_vector_M2T     << std::endl;
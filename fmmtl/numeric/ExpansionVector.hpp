@@ -0,0 +1,169 @@
+#pragma once
+/** @file ExpansionVector.hpp
+ * @brief A fixed-size array of expansion coefficients that either owns its
+ * storage or is a view into a slab of an ExpansionArena.
+ *
+ * Expansions that use an ExpansionVector as their multipole_type or
+ * local_type have their coefficients stored contiguously, level by level,
+ * by the Context. Their init_multipole and init_local should use assign(n,v),
+ * which only fills the coefficients of a view of size n.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <type_traits>
+
+#include "fmmtl/config.hpp"
+
+namespace fmmtl {
+
+template <typename T>
+class ExpansionVector {
+ public:
+  typedef T                 value_type;
+  typedef T&                reference;
+  typedef const T&          const_reference;
+  typedef T*                iterator;
+  typedef const T*          const_iterator;
+  typedef std::size_t       size_type;
+
+ private:
+  T*        data_;
+  size_type size_;
+  //! Whether data_ was allocated by this vector
+  bool      owner_;
+
+  void reset(size_type n) {
+    if (owner_)
+      delete[] data_;
+    data_  = n ? new T[n] : nullptr;
+    size_  = n;
+    owner_ = true;
+  }
+
+ public:
+  //! Construct an empty vector
+  ExpansionVector()
+      : data_(nullptr), size_(0), owner_(false) {
+  }
+  //! Construct a vector that owns n copies of v
+  explicit ExpansionVector(size_type n, const T& v = T())
+      : ExpansionVector() {
+    assign(n, v);
+  }
+  //! Construct a vector that owns a copy of the coefficients of @a o
+  ExpansionVector(const ExpansionVector& o)
+      : ExpansionVector() {
+    assign(o.begin(), o.end());
+  }
+  /** Construct a vector that takes the storage, or view, of @a o.
+   * noexcept, so that a std::vector of views moves them on reallocation
+   * rather than making owning copies that detach them from their slab.
+   */
+  ExpansionVector(ExpansionVector&& o) noexcept
+      : data_(o.data_), size_(o.size_), owner_(o.owner_) {
+    o.data_  = nullptr;
+    o.size_  = 0;
+    o.owner_ = false;
+  }
+  ~ExpansionVector() {
+    if (owner_)
+      delete[] data_;
+  }
+
+  /** Copy the coefficients of @a o. A view of the same size stays a view. */
+  ExpansionVector& operator=(const ExpansionVector& o) {
+    if (this != &o)
+      assign(o.begin(), o.end());
+    return *this;
+  }
+  /** Copy the coefficients of @a o if of the same size, so a view stays a
+   * view. Otherwise take the storage, or view, of @a o. Never allocates.
+   */
+  ExpansionVector& operator=(ExpansionVector&& o)
+      noexcept(std::is_nothrow_copy_assignable<T>::value) {
+    if (size_ == o.size_) {
+      std::copy(o.begin(), o.end(), data_);
+      return *this;
+    }
+    if (owner_)
+      delete[] data_;
+    data_  = o.data_;
+    size_  = o.size_;
+    owner_ = o.owner_;
+    o.data_  = nullptr;
+    o.size_  = 0;
+    o.owner_ = false;
+    return *this;
+  }
+
+  /** Set the coefficients to n copies of v
+   * Only fills the existing storage if this already has size n.
+   */
+  void assign(size_type n, const T& v) {
+    if (size_ != n)
+      reset(n);
+    std::fill(data_, data_ + n, v);
+  }
+  /** Set the coefficients to a copy of [first, last)
+   * Only copies into the existing storage if this already has that size.
+   */
+  template <typename Iter>
+  void assign(Iter first, Iter last) {
+    const size_type n = std::distance(first, last);
+    if (size_ != n)
+      reset(n);
+    std::copy(first, last, data_);
+  }
+
+  /** Make this a view of the n coefficients starting at @a p
+   * @pre p remains valid for the lifetime of this view
+   */
+  void bind(T* p, size_type n) {
+    if (owner_)
+      delete[] data_;
+    data_  = p;
+    size_  = n;
+    owner_ = false;
+  }
+
+  //! Whether this vector owns its storage
+  bool owner() const { return owner_; }
+
+  size_type size()  const { return size_; }
+  bool      empty() const { return size_ == 0; }
+
+  T*       data()       { return data_; }
+  const T* data() const { return data_; }
+
+  iterator       begin()       { return data_; }
+  const_iterator begin() const { return data_; }
+  iterator       end()         { return data_ + size_; }
+  const_iterator end()   const { return data_ + size_; }
+
+  reference operator[](size_type i) {
+    FMMTL_ASSERT(i < size_);
+    return data_[i];
+  }
+  const_reference operator[](size_type i) const {
+    FMMTL_ASSERT(i < size_);
+    return data_[i];
+  }
+};
+
+template <typename T>
+std::ostream& operator<<(std::ostream& s, const ExpansionVector<T>& v) {
+  s << "(";
+  for (std::size_t i = 0; i != v.size(); ++i)
+    s << (i ? ", " : "") << v[i];
+  return s << ")";
+}
+
+/** Whether a type is an ExpansionVector */
+template <typename T>
+struct is_expansion_vector : std::false_type {};
+template <typename T>
+struct is_expansion_vector<ExpansionVector<T> > : std::true_type {};
+
+} // end namespace fmmtl
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "fmmtl/traversal/SubtreeBlocks.hpp"
+
 /** @brief Process the boxes from top to bottom
  * concept Tree {
  *   unsigned levels();                       // Levels in the tree, root:0
@@ -24,3 +26,42 @@ struct DownwardPass {
     }
   }
 };
+
+/** @brief Process the boxes from top to bottom, one subtree at a time
+ * The top of the tree is processed level by level. Each subtree of the
+ * SubtreeBlocks is then processed in pre-order by a single thread, so a box's
+ * children are evaluated while the data of the box is still in cache.
+ * concept Evaluator {
+ *   void operator()(typename Tree::box_type& b);   // Process box b
+ * }
+ * The Evaluator may be called concurrently on boxes of different subtrees or
+ * on boxes of the same level.
+ */
+struct BlockedDownwardPass {
+  template <class Tree, class Evaluator>
+  inline static void eval(const SubtreeBlocks<Tree>& blocks, Evaluator& eval) {
+    for (unsigned l = 0; l < blocks.top_levels(); ++l) {
+      auto& top = blocks.top(l);
+#pragma omp parallel for schedule(dynamic)
+      for (auto bit = top.begin(); bit < top.end(); ++bit) {
+        auto box = *bit;
+        eval(box);
+      }
+    }
+
+    auto& roots = blocks.subtrees();
+#pragma omp parallel for schedule(dynamic)
+    for (auto bit = roots.begin(); bit < roots.end(); ++bit)
+      preorder(*bit, eval);
+  }
+
+  template <class Box, class Evaluator>
+  inline static void preorder(Box box, Evaluator& eval) {
+    eval(box);
+    if (!box.is_leaf()) {
+      auto c_end = box.child_end();
+      for (auto cit = box.child_begin(); cit != c_end; ++cit)
+        preorder(*cit, eval);
+    }
+  }
+};
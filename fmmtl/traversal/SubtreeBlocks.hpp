@@ -0,0 +1,85 @@
+#pragma once
+/** @file SubtreeBlocks
+ * @brief Partition a tree into disjoint subtrees of bounded size so that
+ * tree passes can process each subtree while its data is still in cache.
+ */
+
+#include <vector>
+#include <algorithm>
+
+#include "fmmtl/tree/TreeRange.hpp"
+
+/** @class SubtreeBlocks
+ * @brief A partition of the boxes of a tree into
+ *   1) the top of the tree: boxes with more than max_boxes boxes in their
+ *      subtree, stored level by level, and
+ *   2) the subtrees: maximal subtrees with at most max_boxes boxes,
+ *      represented by their roots.
+ * Each box of the tree is either in the top or in exactly one subtree.
+ *
+ * concept Tree {
+ *   unsigned levels();
+ *   unsigned boxes();
+ *   box_type root();
+ *   box_iterator box_begin(unsigned level);
+ *   box_iterator box_end(unsigned level);
+ * }
+ */
+template <class Tree>
+class SubtreeBlocks {
+ public:
+  typedef typename Tree::box_type box_type;
+
+ private:
+  //! The boxes of the top of the tree by level
+  std::vector<std::vector<box_type>> top_;
+  //! The roots of the subtrees, largest subtrees first
+  std::vector<box_type> roots_;
+
+ public:
+  SubtreeBlocks() {}
+
+  SubtreeBlocks(const Tree& tree, std::size_t max_boxes) {
+    // Count the boxes in the subtree of each box
+    std::vector<std::size_t> count(tree.boxes(), 1);
+    for (unsigned L = tree.levels()-1; L > 0; --L)
+      for (auto&& box : fmmtl::boxes(L, tree))
+        count[box.parent().index()] += count[box.index()];
+
+    // From the top, a box is the root of a subtree if it is small enough
+    std::vector<char> in_top(tree.boxes(), false);
+    for (unsigned L = 0; L < tree.levels(); ++L) {
+      for (auto&& box : fmmtl::boxes(L, tree)) {
+        if (L != 0 && !in_top[box.parent().index()])
+          continue;
+        if (count[box.index()] <= max_boxes) {
+          roots_.push_back(box);
+        } else {
+          if (top_.size() <= L)
+            top_.resize(L+1);
+          top_[L].push_back(box);
+          in_top[box.index()] = true;
+        }
+      }
+    }
+
+    // Schedule the largest subtrees first
+    std::stable_sort(roots_.begin(), roots_.end(),
+                     [&](const box_type& a, const box_type& b) {
+                       return count[a.index()] > count[b.index()];
+                     });
+  }
+
+  //! The number of levels in the top of the tree
+  unsigned top_levels() const {
+    return top_.size();
+  }
+  //! The boxes of level @a L in the top of the tree
+  const std::vector<box_type>& top(unsigned L) const {
+    return top_[L];
+  }
+  //! The roots of the subtrees
+  const std::vector<box_type>& subtrees() const {
+    return roots_;
+  }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "fmmtl/dispatch/Dispatchers.hpp"
+#include "fmmtl/traversal/SubtreeBlocks.hpp"
 
 
 /** @brief Process the boxes from bottom to top
@@ -28,6 +29,45 @@ struct UpwardPass {
 	}
 };
 
+/** @brief Process the boxes from bottom to top, one subtree at a time
+ * Each subtree of the SubtreeBlocks is processed in post-order by a single
+ * thread, so a box is evaluated while the data of its children is still in
+ * cache. The top of the tree is then processed level by level.
+ * concept Evaluator {
+ *   void operator()(typename Tree::box_type& b);   // Process box b
+ * }
+ * The Evaluator may be called concurrently on boxes of different subtrees or
+ * on boxes of the same level.
+ */
+struct BlockedUpwardPass {
+  template <typename Tree, class Evaluator>
+  inline static void eval(const SubtreeBlocks<Tree>& blocks, Evaluator& eval) {
+    auto& roots = blocks.subtrees();
+#pragma omp parallel for schedule(dynamic)
+    for (auto bit = roots.begin(); bit < roots.end(); ++bit)
+      postorder(*bit, eval);
+
+    for (int l = blocks.top_levels()-1; l >= 0; --l) {
+      auto& top = blocks.top(l);
+#pragma omp parallel for schedule(dynamic)
+      for (auto bit = top.begin(); bit < top.end(); ++bit) {
+        auto box = *bit;
+        eval(box);
+      }
+    }
+  }
+
+  template <typename Box, class Evaluator>
+  inline static void postorder(Box box, Evaluator& eval) {
+    if (!box.is_leaf()) {
+      auto c_end = box.child_end();
+      for (auto cit = box.child_begin(); cit != c_end; ++cit)
+        postorder(*cit, eval);
+    }
+    eval(box);
+  }
+};
+
 /** Helper for computing the multipole for a box and all sub-boxes
  */
 struct ComputeM {
@@ -2,6 +2,12 @@
 
 #include <iterator>
 #include <vector>
+#include <algorithm>
+
+#include "fmmtl/config.hpp"
+#include "fmmtl/util/SoA.hpp"
+#include "fmmtl/util/AlignedAllocator.hpp"
+#include "fmmtl/tree/TreeRange.hpp"
 
 
 /** Maps boxes and box iterators to data and data iterators
@@ -115,3 +121,126 @@ BodyBind<Type, Tree>
 make_body_binding(const Tree& tree) {
   return {tree.bodies()};
 }
+
+
+/** Maps boxes to padded structure-of-arrays views of their body data
+ *
+ * The bodies are stored in tree order with one array per component. Each
+ * leaf starts on a multiple of FMMTL_SIMD_WIDTH and is padded to a multiple of
+ * FMMTL_SIMD_WIDTH, so the view of a box covers its leaves and their padding.
+ */
+template <typename T, typename Tree>
+struct SoABind {
+  typedef fmmtl::soa_traits<T>          traits;
+  typedef typename traits::value_type   value_type;
+  typedef fmmtl::SoAView<T>             view_type;
+  typedef typename Tree::box_type       box_type;
+  static const std::size_t components = traits::components;
+
+  typedef std::vector<value_type, fmmtl::aligned_allocator<value_type> >
+  container_type;
+
+  //! Component k of padded body i is data[k*stride + i]
+  container_type data;
+  std::size_t stride;
+  //! The padded range of bodies of each box by index
+  std::vector<std::pair<std::size_t,std::size_t> > range;
+  //! The leaves of the tree in body order
+  std::vector<box_type> leaves;
+
+  SoABind() : stride(0) {}
+
+  explicit SoABind(const Tree& tree)
+      : range(tree.boxes()) {
+    const std::size_t W = FMMTL_SIMD_WIDTH;
+
+    for (auto&& box : fmmtl::boxes(tree))
+      if (box.is_leaf())
+        leaves.push_back(box);
+    std::sort(leaves.begin(), leaves.end(),
+              [](const box_type& a, const box_type& b) {
+                return a.body_begin().index() < b.body_begin().index();
+              });
+
+    // Assign padded ranges to the leaves, then to their ancestors
+    std::size_t n = 0;
+    for (auto&& leaf : leaves) {
+      range[leaf.index()].first = n;
+      n += (leaf.num_bodies() + W - 1) / W * W;
+      range[leaf.index()].second = n;
+    }
+    for (unsigned L = tree.levels(); L-- > 0; ) {
+      for (auto&& box : fmmtl::boxes(L, tree)) {
+        if (box.is_leaf())
+          continue;
+        auto& r = range[box.index()];
+        r.first = n; r.second = 0;
+        for (auto&& child : fmmtl::children(box)) {
+          r.first  = std::min(r.first,  range[child.index()].first);
+          r.second = std::max(r.second, range[child.index()].second);
+        }
+      }
+    }
+
+    // Align the array of each component to a cache line
+    const std::size_t line = std::max<std::size_t>(W, 64 / sizeof(value_type));
+    stride = (n + line - 1) / line * line;
+    data.assign(components * stride, value_type());
+  }
+
+  /** Fill the arrays from the tree-ordered body data at @a first.
+   * The padding of each leaf repeats the last body of the leaf.
+   */
+  template <typename Iterator>
+  void assign(Iterator first) {
+    fill(first, nullptr);
+  }
+  /** Fill the arrays from the tree-ordered body data at @a first.
+   * The padding of each leaf is @a pad.
+   */
+  template <typename Iterator>
+  void assign(Iterator first, const T& pad) {
+    fill(first, &pad);
+  }
+
+  //! The view of the bodies of @a box
+  view_type operator[](const box_type& box) const {
+    return view(box, box);
+  }
+  /** The view of the bodies of @a first through @a last
+   * @pre The bodies of @a first through @a last are contiguous
+   */
+  view_type view(const box_type& first, const box_type& last) const {
+    const std::size_t b = range[first.index()].first;
+    const std::size_t e = range[last.index()].second;
+    FMMTL_ASSERT(b <= e);
+    return {data.data() + b, stride, e - b};
+  }
+
+  //! The bytes of memory used by the arrays
+  std::size_t bytes() const {
+    return sizeof(*this) + data.capacity() * sizeof(value_type) +
+        range.capacity() * sizeof(range[0]) +
+        leaves.capacity() * sizeof(box_type);
+  }
+
+ private:
+  template <typename Iterator>
+  void fill(Iterator first, const T* pad) {
+    const int num_leaves = leaves.size();
+#pragma omp parallel for
+    for (int k = 0; k < num_leaves; ++k) {
+      const box_type& leaf = leaves[k];
+      const std::size_t n = leaf.num_bodies();
+      if (n == 0)
+        continue;
+      const auto& r = range[leaf.index()];
+      Iterator body = first + leaf.body_begin().index();
+      for (std::size_t i = 0; i < r.second - r.first; ++i) {
+        const T& x = (i < n) ? body[i] : (pad ? *pad : body[n-1]);
+        for (std::size_t c = 0; c < components; ++c)
+          data[c*stride + r.first + i] = traits::get(x, c);
+      }
+    }
+  }
+};
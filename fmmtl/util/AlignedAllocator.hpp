@@ -0,0 +1,57 @@
+#pragma once
+/** @file AlignedAllocator
+ * @brief A standard allocator that aligns its allocations, e.g. to cache
+ * lines, so that containers of numbers can be loaded with aligned vector
+ * instructions.
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace fmmtl {
+
+template <typename T, std::size_t Align = 64>
+struct aligned_allocator {
+  static_assert(Align >= sizeof(void*) && (Align & (Align-1)) == 0,
+                "Alignment must be a power of two multiple of sizeof(void*)");
+
+  typedef T           value_type;
+  typedef T*          pointer;
+  typedef const T*    const_pointer;
+  typedef std::size_t size_type;
+
+  template <typename U>
+  struct rebind {
+    typedef aligned_allocator<U,Align> other;
+  };
+
+  aligned_allocator() {}
+  template <typename U>
+  aligned_allocator(const aligned_allocator<U,Align>&) {}
+
+  T* allocate(std::size_t n) {
+    if (n == 0)
+      return nullptr;
+    void* p = nullptr;
+    if (posix_memalign(&p, Align, n * sizeof(T)) != 0)
+      throw std::bad_alloc();
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, std::size_t) {
+    std::free(p);
+  }
+};
+
+template <typename T, typename U, std::size_t Align>
+inline bool operator==(const aligned_allocator<T,Align>&,
+                       const aligned_allocator<U,Align>&) {
+  return true;
+}
+template <typename T, typename U, std::size_t Align>
+inline bool operator!=(const aligned_allocator<T,Align>&,
+                       const aligned_allocator<U,Align>&) {
+  return false;
+}
+
+} // end namespace fmmtl
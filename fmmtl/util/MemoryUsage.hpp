@@ -0,0 +1,39 @@
+#pragma once
+/** @file MemoryUsage
+ * @brief Estimates of the memory footprint of objects, including the
+ * dynamic memory they own.
+ */
+
+#include <cstddef>
+#include <vector>
+
+#include "fmmtl/numeric/ExpansionVector.hpp"
+
+namespace fmmtl {
+
+/** The memory used by an object that owns no dynamic memory */
+template <typename T>
+inline std::size_t memory_usage(const T&) {
+  return sizeof(T);
+}
+
+/** The memory used by a std::vector and its elements */
+template <typename T, typename Alloc>
+inline std::size_t memory_usage(const std::vector<T,Alloc>& v) {
+  std::size_t bytes = sizeof(v) + (v.capacity() - v.size()) * sizeof(T);
+  for (auto&& x : v)
+    bytes += memory_usage(x);
+  return bytes;
+}
+
+/** The memory used by an ExpansionVector and its coefficients, whether it
+ * owns them or views them */
+template <typename T>
+inline std::size_t memory_usage(const ExpansionVector<T>& v) {
+  std::size_t bytes = sizeof(v);
+  for (auto&& x : v)
+    bytes += memory_usage(x);
+  return bytes;
+}
+
+} // end namespace fmmtl
@@ -0,0 +1,99 @@
+#pragma once
+/** @file SoA
+ * @brief Structure-of-arrays views of body data. The components of a range of
+ * bodies are stored in separate arrays so that vectorized kernels and
+ * expansions load them without gathers.
+ */
+
+#include <cstddef>
+
+#include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/Complex.hpp"
+
+namespace fmmtl {
+
+/** Describes the decomposition of a body type into scalar components.
+ * The primary template is for types without an SoA decomposition.
+ *
+ * float_type is the single-precision counterpart of the type, used by the
+ * mixed-precision near field.
+ */
+template <typename T>
+struct soa_traits {
+  static const bool value = false;
+  static const std::size_t components = 0;
+  typedef double value_type;
+  typedef T      float_type;
+  static value_type get(const T&, std::size_t) { return value_type(); }
+};
+
+template <>
+struct soa_traits<double> {
+  static const bool value = true;
+  static const std::size_t components = 1;
+  typedef double value_type;
+  typedef float  float_type;
+  static value_type get(const double& x, std::size_t) { return x; }
+};
+
+template <>
+struct soa_traits<float> {
+  static const bool value = true;
+  static const std::size_t components = 1;
+  typedef float value_type;
+  typedef float float_type;
+  static value_type get(const float& x, std::size_t) { return x; }
+};
+
+template <std::size_t N, typename T>
+struct soa_traits<Vec<N,T> > {
+  static const bool value = true;
+  static const std::size_t components = N;
+  typedef T value_type;
+  typedef Vec<N,float> float_type;
+  static value_type get(const Vec<N,T>& x, std::size_t i) { return x[i]; }
+};
+
+template <typename T>
+struct soa_traits<complex<T> > {
+  static const bool value = true;
+  static const std::size_t components = 2;
+  typedef T value_type;
+  typedef complex<float> float_type;
+  static value_type get(const complex<T>& x, std::size_t i) {
+    return i == 0 ? x.real() : x.imag();
+  }
+};
+
+
+/** @class SoAView
+ * @brief A read-only structure-of-arrays view of a range of bodies.
+ *
+ * Component k of body i of the range is (*this)[k][i]. The range is padded
+ * to a multiple of FMMTL_SIMD_WIDTH bodies and the first body is aligned
+ * to FMMTL_SIMD_WIDTH values, so loops over size() need no remainder.
+ */
+template <typename T>
+struct SoAView {
+  typedef soa_traits<T>                  traits;
+  typedef typename traits::value_type    value_type;
+  static const std::size_t components = traits::components;
+
+  //! Component 0 of the first body of the range
+  const value_type* data;
+  //! Distance between the arrays of consecutive components
+  std::size_t stride;
+  //! The padded number of bodies in the range
+  std::size_t n;
+
+  //! The array of component @a k
+  const value_type* operator[](std::size_t k) const {
+    return data + k * stride;
+  }
+  //! The padded number of bodies in the range
+  std::size_t size() const {
+    return n;
+  }
+};
+
+} // end namespace fmmtl
@@ -106,6 +106,21 @@ class BarycentricTaylor
     }
   }
 
+  // Define the M2L as the (P+1) x (P+1) row-major matrix A with L += A * M
+  void M2L_matrix(const point_type& translation, double* A) const {
+    // g[j] = (-1)^j j! / r^{j+1}
+    double g[2*P+1];
+    double r = 1.0 / translation[0];
+    g[0] = r;
+    for (unsigned j = 1; j <= 2*P; ++j)
+      g[j] = g[j-1] * -r * j;
+
+    // A[n][k] = (-1)^{n+k} (n+k)! / r^{n+k+1}
+    for (unsigned n = 0; n <= P; ++n)
+      for (unsigned k = 0; k <= P; ++k)
+        A[n*(P+1) + k] = g[n+k];
+  }
+
   // Define the L2L
   void L2L(const local_type& Ls,
                  local_type& Lt,
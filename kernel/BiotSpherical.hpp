@@ -15,6 +15,7 @@
 // Use a library-defined Vector class that supports multiple architectures
 #include "fmmtl/numeric/Vec.hpp"
 #include "fmmtl/numeric/Complex.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
 
 #include "kernel/Util/SphericalMultipole3D.hpp"
 
@@ -29,13 +30,16 @@ class BiotSpherical
   typedef Vec<3,real_type> point_type;
 
   //! Multipole expansion type
-  typedef std::vector<Vec<3,complex_type> > multipole_type;
+  typedef fmmtl::ExpansionVector<Vec<3,complex_type> > multipole_type;
   //! Local expansion type
-  typedef std::vector<Vec<3,complex_type> > local_type;
+  typedef fmmtl::ExpansionVector<Vec<3,complex_type> > local_type;
 
   //! Transform operators
   typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
 
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef SphOp::Translation translation_type;
+
   //! Expansion order
   int P;
 
@@ -46,11 +50,11 @@ class BiotSpherical
 
   /** Initialize a multipole expansion with the size of a box at this level */
   void init_multipole(multipole_type& M, const point_type&, unsigned) const {
-    M = multipole_type(P*(P+1)/2);
+    M.assign(P*(P+1)/2, Vec<3,complex_type>());
   }
   /** Initialize a local expansion with the size of a box at this level */
   void init_local(local_type& L, const point_type&, unsigned) const {
-    L = local_type(P*(P+1)/2);
+    L.assign(P*(P+1)/2, Vec<3,complex_type>());
   }
 
   /** Kernel S2M operation
@@ -66,6 +70,13 @@ class BiotSpherical
     return SphOp::S2M(P, center-source, charge, M);
   }
 
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_type(P, translation);
+  }
+
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
    *
@@ -80,6 +91,13 @@ class BiotSpherical
     return SphOp::M2M(P, Msource, Mtarget, translation);
   }
 
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    return SphOp::M2M(P, Msource, Mtarget, T);
+  }
+
   /** Kernel M2L operation
    * L += Op(M)
    *
@@ -95,6 +113,13 @@ class BiotSpherical
     return SphOp::M2L(P, Msource, Ltarget, translation);
   }
 
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::M2L(P, Msource, Ltarget, T);
+  }
+
   /** Kernel L2L operator
    * L_t += Op(L_s) where L_t is the target and L_s is the source
    *
@@ -109,6 +134,13 @@ class BiotSpherical
     return SphOp::L2L(P, Lsource, Ltarget, translation);
   }
 
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::L2L(P, Lsource, Ltarget, T);
+  }
+
   /** Kernel L2T operation
    * r += Op(L, t) where L is the local expansion and r is the result
    *
@@ -154,4 +186,72 @@ class BiotSpherical
     result[1] += c0[2] - c2[0];
     result[2] += c1[0] - c0[1];
   }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   *
+   * The gradients of the three potentials are evaluated across a block of
+   * SphOp::L2T_BLOCK targets, then combined into the curl of each target.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    constexpr int B = SphOp::L2T_BLOCK;
+    real_type x[B], y[B], z[B];
+    real_type rho[B], ct[B], st[B], cp[B], sp[B];
+    // The (rho, theta, phi) gradient of each potential k, then (x, y, z)
+    real_type s0[3][B], s1[3][B], s2[3][B];
+
+    while (t_first != t_last) {
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      SphOp::template cart2sph<B>(nb, x, y, z, rho, ct, st, cp, sp);
+
+      for (int k = 0; k != 3; ++k)
+        for (int i = 0; i != B; ++i)
+          s0[k][i] = s1[k][i] = s2[k][i] = 0;
+
+      SphOp::template evalZ<B>(P, rho, ct, st, cp, sp,
+          [&](int n, int m, int nm,
+              const real_type* Zr, const real_type* Zi,
+              const real_type* dZr, const real_type* dZi) {
+            const real_type f = (m == 0) ? 1 : 2;
+            for (int k = 0; k != 3; ++k) {
+              const real_type Lr = f * L[nm][k].real();
+              const real_type Li = f * L[nm][k].imag();
+              for (int i = 0; i != B; ++i) {
+                s0[k][i] += (Lr*Zr[i] - Li*Zi[i]) * n;
+                s1[k][i] += Lr*dZr[i] - Li*dZi[i];
+                s2[k][i] -= (Lr*Zi[i] + Li*Zr[i]) * m;
+              }
+            }
+          });
+
+      for (int k = 0; k != 3; ++k) {
+        for (int i = 0; i != B; ++i)
+          s0[k][i] /= rho[i];
+        SphOp::template sph2cart<B>(rho, ct, st, cp, sp,
+                                    s0[k], s1[k], s2[k]);
+      }
+
+      // The curl from the gradients (d/dx, d/dy, d/dz) = (s0, s1, s2)
+      for (int i = 0; i != nb; ++i, ++r_first) {
+        auto&& r = *r_first;
+        r[0] += s1[2][i] - s2[1][i];
+        r[1] += s2[0][i] - s0[2][i];
+        r[2] += s0[1][i] - s1[0][i];
+      }
+    }
+  }
 };
@@ -0,0 +1,478 @@
+#pragma once
+/** @file HelmholtzSpherical.hpp
+ * @brief Implements the Helmholtz kernels with low-frequency spherical
+ * expansions.
+ *
+ * K(t,s) = exp(ikR) / R                     // HelmholtzPotential
+ * K(t,s) = {exp(ikR) / R,                   // HelmholtzKernel
+ *           (s-t) (1-ikR) exp(ikR) / R^3}
+ * where k = kappa, R = |s-t|_2
+ *
+ * With the scaled spherical Bessel and Hankel functions
+ *   J_n(r) = j_n(kappa r) (2n+1)!! / kappa^n          -> r^n
+ *   H_n(r) = i h_n(kappa r) kappa^{n+1} / (2n-1)!!    -> r^{-n-1}
+ * the kernel has the expansion, for |y| < |x|,
+ *   exp(ik |x-y|) / |x-y| = sum_n J_n(|y|) H_n(|x|) P_n(cos gamma)
+ * which is that of the Laplace kernel, to which it reduces as kappa -> 0.
+ * The expansions are those of SphericalMultipole3D with rho^n and
+ * rho^{-n-1} replaced by J_n and H_n, and are translated as in
+ * YukawaSpherical.
+ *
+ * The harmonics of SphericalMultipole3D only store the orders m >= 0 of
+ * fields with the symmetry of real fields, C_n^{-m} = (-1)^m conj(C_n^m).
+ * The charges and H_n are complex, so each coefficient stores the fields
+ * U and V of the real and imaginary parts of the charges, and the complex
+ * translations are applied to the field U + iV by their real and
+ * imaginary parts.
+ *
+ * The number of terms needed grows with kappa times the size of a box, so
+ * the order of the expansions is chosen per level, see order(). This is
+ * a low-frequency expansion: the translations lose accuracy once kappa
+ * times the size of the largest boxes is more than a few tens.
+ */
+
+#include <algorithm>
+#include <complex>
+#include <cmath>
+#include <type_traits>
+
+#include "fmmtl/Expansion.hpp"
+#include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/Complex.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
+
+#include "kernel/Util/SphericalMultipole3D.hpp"
+#include "kernel/Util/CoaxialTranslation3D.hpp"
+
+#include "Helmholtz.kern"
+
+/** HelmholtzSpherical
+ * @tparam Kernel  HelmholtzKernel, or HelmholtzPotential for the potential
+ *                 only
+ */
+template <typename Kernel = HelmholtzKernel>
+class HelmholtzSpherical
+    : public fmmtl::Expansion<Kernel, HelmholtzSpherical<Kernel> > {
+ public:
+  FMMTL_IMPORT_KERNEL_TRAITS(Kernel);
+
+  typedef double real_type;
+  typedef std::complex<real_type> complex_type;
+
+  //! Point type
+  typedef Vec<3,real_type> point_type;
+
+  //! The coefficients of the fields U and V
+  typedef Vec<2,complex_type> coefficient_type;
+
+  //! Multipole expansion type
+  typedef fmmtl::ExpansionVector<coefficient_type> multipole_type;
+  //! Local expansion type
+  typedef fmmtl::ExpansionVector<coefficient_type> local_type;
+
+  //! Harmonics and rotations
+  typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
+
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef CoaxialTranslation3D<point_type,complex_type> translation_type;
+
+  //! Expansion order of the boxes that are small compared to a wavelength
+  int P;
+  //! Largest expansion order of any box
+  int P_max;
+
+  //! Constructor
+  HelmholtzSpherical(int _P = 5, double _kappa = 1, int _P_max = 40)
+      : fmmtl::Expansion<Kernel,HelmholtzSpherical>(Kernel(_kappa)),
+        P(_P), P_max(std::max(_P, _P_max)) {
+  }
+
+  /** The expansion order of a box with diagonal d: P plus the number of
+   * radians of the wave across the box, at most P_max */
+  int order(real_type d) const {
+    using std::ceil;
+    return std::min(P_max, P + int(ceil(this->kappa * d)));
+  }
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M, const point_type& extents,
+                      unsigned) const {
+    const int p = order(norm_2(extents));
+    M.assign(p*(p+1)/2, coefficient_type());
+  }
+  /** Initialize a local expansion with the size of a box at this level */
+  void init_local(local_type& L, const point_type& extents, unsigned) const {
+    const int p = order(norm_2(extents));
+    L.assign(p*(p+1)/2, coefficient_type());
+  }
+
+  /** Kernel S2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] source The point source
+   * @param[in] charge The source's corresponding charge
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  void S2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    const int p = order_of(M);
+    real_type rho, theta, phi;
+    SphOp::cart2sph(rho, theta, phi, center - source);
+    complex_type Z[p*(p+1)/2];
+    SphOp::evalZ(rho, theta, phi, p, Z);
+    real_type J[p];
+    bessel_j(this->kappa * rho, p, J);
+
+    int nm = 0;   // n*(n+1)/2+m
+    for (int n = 0; n != p; ++n) {
+      const real_type cu = charge.real() * J[n];
+      const real_type cv = charge.imag() * J[n];
+      for (int m = 0; m <= n; ++m, ++nm) {
+        const complex_type z = SphOp::neg1pow(m) * conj(Z[nm]);
+        M[nm][0] += z * cu;
+        M[nm][1] += z * cv;
+      }
+    }
+  }
+
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * Without the sizes of the boxes, the order of the translation is that
+   * of a box with diagonal 4|t|. This bounds the boxes of the M2M and L2L
+   * by |t| and those of the M2L by the multipole-acceptance criteria.
+   *
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_of_order(translation, order(4 * norm_2(translation)),
+                                translation_type::REGULAR |
+                                translation_type::SINGULAR);
+  }
+  /** Precompute the data of a translation between two boxes of the given
+   * extents, at the larger of their orders. The center of a child is
+   * within half the diagonal of its parent from the parent's center, the
+   * boxes of an M2L are further apart than that by the MAC.
+   */
+  translation_type make_translation(const point_type& translation,
+                                    const point_type& source_extents,
+                                    const point_type& target_extents) const {
+    const real_type ds = norm_2(source_extents);
+    const real_type dt = norm_2(target_extents);
+    const bool is_M2L = norm_2(translation) >= std::max(ds, dt) / 2;
+    return translation_of_order(translation,
+                                std::max(order(ds), order(dt)),
+                                is_M2L ? translation_type::SINGULAR
+                                       : translation_type::REGULAR);
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    M2M(Msource, Mtarget,
+        translation_of_order(translation,
+                             std::max(order_of(Msource), order_of(Mtarget)),
+                             translation_type::REGULAR));
+  }
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    translate(T, T.RR.data(), false, Msource, false, Mtarget, false);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] Msource The multpole expansion source
+   * @param[in,out] Ltarget The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    M2L(Msource, Ltarget,
+        translation_of_order(translation,
+                             std::max(order_of(Msource), order_of(Ltarget)),
+                             translation_type::SINGULAR));
+  }
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    translate(T, T.SR.data(), true, Msource, false, Ltarget, true);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    L2L(Lsource, Ltarget,
+        translation_of_order(translation,
+                             std::max(order_of(Lsource), order_of(Ltarget)),
+                             translation_type::REGULAR));
+  }
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    translate(T, T.RR.data(), true, Lsource, true, Ltarget, true);
+  }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   *
+   * The targets are evaluated in blocks of SphOp::L2T_BLOCK as in
+   * YukawaSpherical, once for each of the fields U and V.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    constexpr int B = SphOp::L2T_BLOCK;
+    const int p = order_of(L);
+    real_type x[B], y[B], z[B];
+    real_type rho[B], ct[B], st[B], cp[B], sp[B];
+    // The potential and spherical gradient of U in [0], of V in [1]
+    real_type pot[2][B], s0[2][B], s1[2][B], s2[2][B], sr[2][B];
+    real_type J[(p+1)*B], Ji[p+1];
+    const real_type kappa = this->kappa;
+
+    while (t_first != t_last) {
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      SphOp::template cart2sph<B>(nb, x, y, z, rho, ct, st, cp, sp);
+
+      // J_n(rho) / rho^n for n <= p, degree p for the radial derivative
+      for (int i = 0; i != B; ++i) {
+        bessel_j(kappa * rho[i], p+1, Ji);
+        for (int n = 0; n <= p; ++n)
+          J[n*B + i] = Ji[n];
+      }
+
+      for (int c = 0; c != 2; ++c)
+        for (int i = 0; i != B; ++i)
+          pot[c][i] = s0[c][i] = s1[c][i] = s2[c][i] = sr[c][i] = 0;
+
+      SphOp::template evalZ<B>(p, rho, ct, st, cp, sp,
+          [&](int n, int m, int nm,
+              const real_type* Zr, const real_type* Zi,
+              const real_type* dZr, const real_type* dZi) {
+            // Z_n^{-m} = (-1)^m conj(Z_n^m) doubles the real part for m > 0
+            const real_type f = (m == 0) ? 1 : 2;
+            const real_type* Jn  = J + n*B;
+            const real_type* Jn1 = J + (n+1)*B;
+            const real_type a = -kappa * kappa / (2*n+3);
+            for (int c = 0; c != 2; ++c) {
+              const real_type Lr = f * L[nm][c].real();
+              const real_type Li = f * L[nm][c].imag();
+              for (int i = 0; i != B; ++i) {
+                const real_type LZ = Lr*Zr[i] - Li*Zi[i];
+                pot[c][i] += Jn[i] * LZ;
+                if (gradient) {
+                  s0[c][i] += Jn[i] * LZ * n;
+                  sr[c][i] += Jn1[i] * LZ * a;
+                  s1[c][i] += Jn[i] * (Lr*dZr[i] - Li*dZi[i]);
+                  s2[c][i] -= Jn[i] * (Lr*Zi[i] + Li*Zr[i]) * m;
+                }
+              }
+            }
+          });
+
+      // d/drho (J_n/rho^n) = -kappa^2 rho J_{n+1}/rho^{n+1} / (2n+3)
+      if (gradient) {
+        for (int c = 0; c != 2; ++c) {
+          for (int i = 0; i != B; ++i)
+            s0[c][i] = s0[c][i] / rho[i] + sr[c][i] * rho[i];
+          SphOp::template sph2cart<B>(rho, ct, st, cp, sp,
+                                      s0[c], s1[c], s2[c]);
+        }
+      }
+
+      for (int i = 0; i != nb; ++i, ++r_first)
+        accumulate(*r_first, i, pot, s0, s1, s2);
+    }
+  }
+
+  /** The scaled spherical Bessel functions of the first kind,
+   *   J[n] = j_n(z) (2n+1)!! / z^n,  0 <= n < N,
+   * by Miller's downward recurrence
+   *   J[n-1] = J[n] - z^2 J[n+1] / ((2n+1)(2n+3))
+   * from far enough above N and z that J[n] is close to 1, normalized by
+   * whichever of J[0] = sin(z)/z and J[1] = 3 (sin(z) - z cos(z))/z^3 is
+   * further from a zero.
+   */
+  static void bessel_j(real_type z, int N, real_type* J) {
+    using std::sin;
+    using std::cos;
+    using std::sqrt;
+    const real_type z2 = z * z;
+    const int M = std::max(N, int(z)) + 16 + int(sqrt(40 * z));
+    real_type j1 = 1, j0 = 1;     // J[n+1], J[n]
+    real_type J1 = 1;
+    for (int n = M; n > 0; --n) {
+      const real_type j = j0 - z2 * j1 / ((2*n+1) * (2*n+3));
+      j1 = j0;
+      j0 = j;
+      if (n-1 < N)
+        J[n-1] = j;
+      if (n == 2)
+        J1 = j;
+    }
+    const real_type J0 = j0;
+
+    // For z < 2 the closed form of J[1] cancels, but J[0] > 0.45
+    const real_type e0 = (z == 0) ? 1 : sin(z) / z;
+    const real_type e1 = (z < 2) ? 0 : 3 * (sin(z) - z * cos(z)) / (z2 * z);
+    const real_type s = (std::abs(e0) >= std::abs(e1)) ? e0 / J0 : e1 / J1;
+    for (int n = 0; n != N; ++n)
+      J[n] *= s;
+  }
+
+  /** The scaled spherical Hankel functions of the first kind,
+   *   H[n] = i h_n(z) z^{n+1} / (2n-1)!!,  0 <= n < N,
+   * by the upward recurrence H[n+1] = H[n] - z^2 H[n-1] / ((2n+1)(2n-1)).
+   */
+  static void bessel_h(real_type z, int N, complex_type* H) {
+    H[0] = complex_type(std::cos(z), std::sin(z));
+    if (N > 1)
+      H[1] = H[0] * complex_type(1, -z);
+    for (int n = 1; n+1 < N; ++n)
+      H[n+1] = H[n] - z*z * H[n-1] / real_type((2*n+1) * (2*n-1));
+  }
+
+ private:
+  //! Whether the kernel has a gradient to evaluate in L2T
+  static constexpr bool gradient =
+      !std::is_same<result_type, fmmtl::complex<real_type> >::value;
+
+  //! The order of the expansion E
+  template <typename Expansion>
+  static int order_of(const Expansion& E) {
+    using std::sqrt;
+    return int(sqrt(real_type(8*E.size() + 1)) + 0.5) / 2;
+  }
+
+  //! The translation t of order p with the matrices @a which
+  translation_type translation_of_order(const point_type& t, int p,
+                                        int which) const {
+    // No j_n has two zeros within a quarter wavelength
+    return translation_type(p, t,
+                            [this](real_type r, int N, complex_type* f) {
+                              regular(r, N, f);
+                            },
+                            [this](real_type r, int N, complex_type* f) {
+                              singular(r, N, f);
+                            },
+                            M_PI / (2 * this->kappa), which);
+  }
+
+  //! The regular radial functions J_n(r) for n < N
+  void regular(real_type r, int N, complex_type* f) const {
+    real_type J[N];
+    bessel_j(this->kappa * r, N, J);
+    real_type rn = 1;
+    for (int n = 0; n != N; ++n, rn *= r)
+      f[n] = J[n] * rn;
+  }
+  //! The singular radial functions H_n(r) for n < N
+  void singular(real_type r, int N, complex_type* f) const {
+    bessel_h(this->kappa * r, N, f);
+    const real_type ir = 1 / r;
+    real_type rn = ir;
+    for (int n = 0; n != N; ++n, rn *= ir)
+      f[n] *= rn;
+  }
+
+  //! Add the potential of target i to a HelmholtzPotential result
+  static void accumulate(fmmtl::complex<real_type>& r, int i,
+                         const real_type (*pot)[SphOp::L2T_BLOCK],
+                         const real_type (*)[SphOp::L2T_BLOCK],
+                         const real_type (*)[SphOp::L2T_BLOCK],
+                         const real_type (*)[SphOp::L2T_BLOCK]) {
+    r += fmmtl::complex<real_type>(pot[0][i], pot[1][i]);
+  }
+  //! Add the potential and gradient of target i to a HelmholtzKernel result
+  template <typename Result>
+  static void accumulate(Result& r, int i,
+                         const real_type (*pot)[SphOp::L2T_BLOCK],
+                         const real_type (*g0)[SphOp::L2T_BLOCK],
+                         const real_type (*g1)[SphOp::L2T_BLOCK],
+                         const real_type (*g2)[SphOp::L2T_BLOCK]) {
+    typedef fmmtl::complex<real_type> complex;
+    r[0] += complex(pot[0][i], pot[1][i]);
+    r[1] += complex(g0[0][i], g0[1][i]);
+    r[2] += complex(g1[0][i], g1[1][i]);
+    r[3] += complex(g2[0][i], g2[1][i]);
+  }
+
+  /** Rotate E into the frame of T, apply the coaxial matrix C to the field
+   * U + iV, and rotate the result back into F. The orders of E and F may
+   * differ and are truncated to that of T.
+   */
+  template <typename Ein, typename Eout>
+  void translate(const translation_type& T, const complex_type* C,
+                 bool transpose,
+                 const Ein& E, bool E_is_local,
+                 Eout& F, bool F_is_local) const {
+    const int pi = std::min(order_of(E), T.P);
+    const int po = std::min(order_of(F), T.P);
+    const typename SphOp::RotationTable& R =
+        SphOp::rotation_table(std::max(pi, po));
+    complex_type XU[pi*(pi+1)/2], XV[pi*(pi+1)/2];
+    complex_type YU[po*(po+1)/2], YV[po*(po+1)/2];
+    SphOp::rotate_to_frame(R, T, pi, E, 0, E_is_local, XU);
+    SphOp::rotate_to_frame(R, T, pi, E, 1, E_is_local, XV);
+
+    // Y = C X with C = A + iB on U + iV: U' = AU - BV, V' = BU + AV
+    for (int m = 0; m != po; ++m) {
+      const complex_type* Cm = C + translation_type::offset(T.P, m);
+      const int Nm = T.P - m;
+      // The strides of C^m in n and in k
+      const int sn = transpose ? 1 : Nm;
+      const int sk = transpose ? Nm : 1;
+      for (int n = m; n != po; ++n) {
+        const complex_type* Cmn = Cm + (n-m)*sn - m*sk;
+        complex_type u = 0, v = 0;
+        for (int k = m; k < pi; ++k) {
+          const complex_type& c = Cmn[k*sk];
+          const complex_type& xu = XU[k*(k+1)/2 + m];
+          const complex_type& xv = XV[k*(k+1)/2 + m];
+          u += c.real() * xu - c.imag() * xv;
+          v += c.imag() * xu + c.real() * xv;
+        }
+        YU[n*(n+1)/2 + m] = u;
+        YV[n*(n+1)/2 + m] = v;
+      }
+    }
+
+    SphOp::rotate_from_frame(R, T, po, YU, F_is_local, F, 0);
+    SphOp::rotate_from_frame(R, T, po, YV, F_is_local, F, 1);
+  }
+};
@@ -13,6 +13,7 @@
 #include "fmmtl/Expansion.hpp"
 #include "fmmtl/numeric/Vec.hpp"
 #include "fmmtl/numeric/Complex.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
 
 #include "kernel/Util/SphericalMultipole3D.hpp"
 
@@ -28,13 +29,16 @@ class LaplaceSpherical
   typedef Vec<3,real_type> point_type;
 
   //! Multipole expansion type
-  typedef std::vector<complex_type> multipole_type;
+  typedef fmmtl::ExpansionVector<complex_type> multipole_type;
   //! Local expansion type
-  typedef std::vector<complex_type> local_type;
+  typedef fmmtl::ExpansionVector<complex_type> local_type;
 
   //! Transform operators
   typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
 
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef SphOp::Translation translation_type;
+
   //! Expansion order
   int P;
 
@@ -45,11 +49,11 @@ class LaplaceSpherical
 
   /** Initialize a multipole expansion with the size of a box at this level */
   void init_multipole(multipole_type& M, const point_type&, unsigned) const {
-    M = std::vector<complex_type>(P*(P+1)/2);
+    M.assign(P*(P+1)/2, complex_type(0));
   }
   /** Initialize a local expansion with the size of a box at this level */
   void init_local(local_type& L, const point_type&, unsigned) const {
-    L = std::vector<complex_type>(P*(P+1)/2);
+    L.assign(P*(P+1)/2, complex_type(0));
   }
 
   /** Kernel S2M operation
@@ -65,6 +69,13 @@ class LaplaceSpherical
     return SphOp::S2M(P, center-source, charge, M);
   }
 
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_type(P, translation);
+  }
+
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
    *
@@ -79,6 +90,13 @@ class LaplaceSpherical
     return SphOp::M2M(P, Msource, Mtarget, translation);
   }
 
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    return SphOp::M2M(P, Msource, Mtarget, T);
+  }
+
   /** Kernel M2L operation
    * L += Op(M)
    *
@@ -94,6 +112,13 @@ class LaplaceSpherical
     return SphOp::M2L(P, Msource, Ltarget, translation);
   }
 
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::M2L(P, Msource, Ltarget, T);
+  }
+
   /** Kernel L2L operator
    * L_t += Op(L_s) where L_t is the target and L_s is the source
    *
@@ -108,6 +133,13 @@ class LaplaceSpherical
     return SphOp::L2L(P, Lsource, Ltarget, translation);
   }
 
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::L2L(P, Lsource, Ltarget, T);
+  }
+
   /** Kernel L2T operation
    * r += Op(L, t) where L is the local expansion and r is the result
    *
@@ -150,4 +182,76 @@ class LaplaceSpherical
     result[2] += cart[1];
     result[3] += cart[2];
   }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   *
+   * The targets are evaluated in blocks of SphOp::L2T_BLOCK, one target per
+   * lane, with the harmonics of the block in structure-of-arrays form.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    return L2T(P, L, center, t_first, t_last, r_first);
+  }
+
+  /** The vectorized L2T of order P for any local container with the
+   * coefficients n*(n+1)/2+m, see LaplaceSphericalP */
+  template <typename Local, typename TargetIter, typename ResultIter>
+  static void L2T(int P, const Local& L, const point_type& center,
+                  TargetIter t_first, TargetIter t_last, ResultIter r_first) {
+    constexpr int B = SphOp::L2T_BLOCK;
+    real_type x[B], y[B], z[B];
+    real_type rho[B], ct[B], st[B], cp[B], sp[B];
+    real_type pot[B], s0[B], s1[B], s2[B];
+
+    while (t_first != t_last) {
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      SphOp::template cart2sph<B>(nb, x, y, z, rho, ct, st, cp, sp);
+
+      for (int i = 0; i != B; ++i)
+        pot[i] = s0[i] = s1[i] = s2[i] = 0;
+
+      SphOp::template evalZ<B>(P, rho, ct, st, cp, sp,
+          [&](int n, int m, int nm,
+              const real_type* Zr, const real_type* Zi,
+              const real_type* dZr, const real_type* dZi) {
+            // Z_n^{-m} = (-1)^m conj(Z_n^m) doubles the real part for m > 0
+            const real_type f  = (m == 0) ? 1 : 2;
+            const real_type Lr = f * L[nm].real();
+            const real_type Li = f * L[nm].imag();
+            for (int i = 0; i != B; ++i) {
+              const real_type LZ = Lr*Zr[i] - Li*Zi[i];
+              pot[i] += LZ;
+              s0[i]  += LZ * n;
+              s1[i]  += Lr*dZr[i] - Li*dZi[i];
+              s2[i]  -= (Lr*Zi[i] + Li*Zr[i]) * m;
+            }
+          });
+
+      for (int i = 0; i != B; ++i)
+        s0[i] /= rho[i];
+      SphOp::template sph2cart<B>(rho, ct, st, cp, sp, s0, s1, s2);
+
+      for (int i = 0; i != nb; ++i, ++r_first) {
+        auto&& r = *r_first;
+        r[0] += pot[i];
+        r[1] += s0[i];
+        r[2] += s1[i];
+        r[3] += s2[i];
+      }
+    }
+  }
 };
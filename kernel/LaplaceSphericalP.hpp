@@ -0,0 +1,145 @@
+#pragma once
+/** @file LaplaceSphericalP.hpp
+ * @brief Implements the Laplace kernel with spherical expansions of an order
+ * fixed at compile time.
+ *
+ * K(t,s) = 1 / |s-t|        // Laplace potential
+ * K(t,s) = (s-t) / |s-t|^3  // Laplace force
+ *
+ * The same operators as LaplaceSpherical, with the expansions stored inline
+ * as std::array and the loops and buffers of each operator sized by P.
+ */
+
+#include <array>
+#include <complex>
+#include <cmath>
+#include <type_traits>
+
+#include "fmmtl/Expansion.hpp"
+#include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/Complex.hpp"
+
+#include "kernel/Util/SphericalMultipole3D.hpp"
+
+#include "LaplaceSpherical.hpp"
+
+/** LaplaceSphericalP
+ * @tparam P  The order of the spherical expansions, the number of degrees
+ */
+template <int P>
+class LaplaceSphericalP
+    : public fmmtl::Expansion<LaplaceKernel, LaplaceSphericalP<P> > {
+  static_assert(P > 0, "Expansion order must be positive");
+
+ public:
+  FMMTL_IMPORT_KERNEL_TRAITS(LaplaceKernel);
+
+  typedef double real_type;
+  typedef std::complex<real_type> complex_type;
+
+  //! Point type
+  typedef Vec<3,real_type> point_type;
+
+  //! The number of coefficients n*(n+1)/2+m, 0 <= m <= n < P
+  static constexpr int size = P*(P+1)/2;
+
+  //! Multipole expansion type
+  typedef std::array<complex_type, size> multipole_type;
+  //! Local expansion type
+  typedef std::array<complex_type, size> local_type;
+
+  //! Transform operators
+  typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
+  //! The order passed to SphOp as a compile-time constant
+  typedef std::integral_constant<int,P> order;
+
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef typename SphOp::Translation translation_type;
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M, const point_type&, unsigned) const {
+    M.fill(complex_type(0));
+  }
+  /** Initialize a local expansion with the size of a box at this level */
+  void init_local(local_type& L, const point_type&, unsigned) const {
+    L.fill(complex_type(0));
+  }
+
+  /** Kernel S2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   */
+  void S2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    return SphOp::S2M(order(), center-source, charge, M);
+  }
+
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_type(P, translation);
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    return SphOp::M2M(order(), Msource, Mtarget, translation);
+  }
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    return SphOp::M2M(order(), Msource, Mtarget, T);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    return SphOp::M2L(order(), Msource, Ltarget, translation);
+  }
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::M2L(order(), Msource, Ltarget, T);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    return SphOp::L2L(order(), Lsource, Ltarget, translation);
+  }
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::L2L(order(), Lsource, Ltarget, T);
+  }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   * A single target is dispatched to this L2T as a range of one.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    // Unrolling the harmonics of the targets in P does not pay, the lanes
+    // of each block are already the inner loop
+    return LaplaceSpherical::L2T(P, L, center, t_first, t_last, r_first);
+  }
+};
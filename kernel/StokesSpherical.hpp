@@ -0,0 +1,278 @@
+#pragma once
+/** @file StokesSpherical.hpp
+ * @brief Implements the Stokeslet kernel with Laplace spherical expansions.
+ *
+ * K(t,s) = I / |s-t| + (s-t) (s-t)^T / |s-t|^3    // Stokeslet
+ *
+ * With the four harmonic potentials of the sources s_k with forces c_k
+ *   phi_j(x) = sum_k c_k[j] / |x-s_k|       for j = 0, 1, 2
+ *   phi_3(x) = sum_k (s_k . c_k) / |x-s_k|
+ * the velocity at a target t is
+ *   u_i(t) = phi_i(t) - sum_j t_j d_i phi_j(t) + d_i phi_3(t)
+ * so one Laplace expansion with four components per coefficient carries the
+ * Stokeslet through a single traversal. The potentials depend on the
+ * absolute positions of the sources, so the sources should be about the
+ * origin: the terms of phi_3 and of t_j d_i phi_j cancel to round-off
+ * relative to the positions.
+ */
+
+#include <complex>
+#include <cmath>
+
+#include "fmmtl/Expansion.hpp"
+#include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/Complex.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
+
+#include "kernel/Util/SphericalMultipole3D.hpp"
+
+#include "Stokes.kern"
+
+class StokesSpherical
+    : public fmmtl::Expansion<Stokeslet, StokesSpherical> {
+ public:
+  typedef double real_type;
+  typedef std::complex<real_type> complex_type;
+
+  //! Point type
+  typedef Vec<3,real_type> point_type;
+
+  //! Multipole expansion type
+  typedef fmmtl::ExpansionVector<Vec<4,complex_type> > multipole_type;
+  //! Local expansion type
+  typedef fmmtl::ExpansionVector<Vec<4,complex_type> > local_type;
+
+  //! Transform operators
+  typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
+
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef SphOp::Translation translation_type;
+
+  //! Expansion order
+  int P;
+
+  //! Constructor
+  StokesSpherical(int _P = 5)
+      : P(_P) {
+  }
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M, const point_type&, unsigned) const {
+    M.assign(P*(P+1)/2, Vec<4,complex_type>());
+  }
+  /** Initialize a local expansion with the size of a box at this level */
+  void init_local(local_type& L, const point_type&, unsigned) const {
+    L.assign(P*(P+1)/2, Vec<4,complex_type>());
+  }
+
+  /** Kernel S2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] source The point source
+   * @param[in] charge The source's corresponding charge
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  void S2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    const Vec<4,real_type> q(charge[0], charge[1], charge[2],
+                             inner_prod(source, charge));
+    return SphOp::S2M(P, center-source, q, M);
+  }
+
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_type(P, translation);
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    return SphOp::M2M(P, Msource, Mtarget, translation);
+  }
+
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    return SphOp::M2M(P, Msource, Mtarget, T);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] Msource The multpole expansion source
+   * @param[in,out] Ltarget The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    return SphOp::M2L(P, Msource, Ltarget, translation);
+  }
+
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::M2L(P, Msource, Ltarget, T);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    return SphOp::L2L(P, Lsource, Ltarget, translation);
+  }
+
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    return SphOp::L2L(P, Lsource, Ltarget, T);
+  }
+
+  /** Kernel L2T operation
+   * r += Op(L, t) where L is the local expansion and r is the result
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] target The target of this L2T operation
+   * @param[in] result The result to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  void L2T(const local_type& L, const point_type& center,
+           const target_type& target, result_type& result) const {
+    using std::real;
+    using std::imag;
+
+    real_type rho, theta, phi;
+    SphOp::cart2sph(rho, theta, phi, target - center);
+    complex_type Z[P*(P+1)/2], dZ[P*(P+1)/2];
+    SphOp::evalZ(rho, theta, phi, P, Z, dZ);
+
+    // The potentials and their (rho, theta, phi) gradients
+    Vec<4,real_type> pot;
+    Vec<3,Vec<4,real_type> > sph;
+    int nm = 0;
+    for (int n = 0; n != P; ++n) {
+      for (int m = 0; m <= n; ++m, ++nm) {
+        // Z_n^{-m} = (-1)^m conj(Z_n^m) doubles the real part for m > 0
+        const real_type f = (m == 0) ? 1 : 2;
+        for (int k = 0; k != 4; ++k) {
+          const complex_type LZ = L[nm][k] * Z[nm];
+          pot[k]    += f * real(LZ);
+          sph[0][k] += f * real(LZ) / rho * n;
+          sph[1][k] += f * (real(L[nm][k])*real(dZ[nm]) -
+                            imag(L[nm][k])*imag(dZ[nm]));
+          sph[2][k] -= f * imag(LZ) * m;
+        }
+      }
+    }
+
+    // The (x, y, z) gradient of each potential
+    point_type grad[4];
+    for (int k = 0; k != 4; ++k)
+      grad[k] = SphOp::sph2cart(rho, theta, phi,
+                                point_type(sph[0][k], sph[1][k], sph[2][k]));
+
+    for (int i = 0; i != 3; ++i)
+      result[i] += pot[i] + grad[3][i] - (target[0] * grad[0][i] +
+                                          target[1] * grad[1][i] +
+                                          target[2] * grad[2][i]);
+  }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   *
+   * The four potentials and their gradients are evaluated across a block of
+   * SphOp::L2T_BLOCK targets, then combined into the velocity of each target.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    constexpr int B = SphOp::L2T_BLOCK;
+    real_type x[B], y[B], z[B];
+    real_type rho[B], ct[B], st[B], cp[B], sp[B];
+    // The potential k and its (rho, theta, phi) gradient, then (x, y, z)
+    real_type pot[4][B], s0[4][B], s1[4][B], s2[4][B];
+
+    while (t_first != t_last) {
+      TargetIter t_block = t_first;
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      SphOp::template cart2sph<B>(nb, x, y, z, rho, ct, st, cp, sp);
+
+      for (int k = 0; k != 4; ++k)
+        for (int i = 0; i != B; ++i)
+          pot[k][i] = s0[k][i] = s1[k][i] = s2[k][i] = 0;
+
+      SphOp::template evalZ<B>(P, rho, ct, st, cp, sp,
+          [&](int n, int m, int nm,
+              const real_type* Zr, const real_type* Zi,
+              const real_type* dZr, const real_type* dZi) {
+            const real_type f = (m == 0) ? 1 : 2;
+            for (int k = 0; k != 4; ++k) {
+              const real_type Lr = f * L[nm][k].real();
+              const real_type Li = f * L[nm][k].imag();
+              for (int i = 0; i != B; ++i) {
+                const real_type LZ = Lr*Zr[i] - Li*Zi[i];
+                pot[k][i] += LZ;
+                s0[k][i]  += LZ * n;
+                s1[k][i]  += Lr*dZr[i] - Li*dZi[i];
+                s2[k][i]  -= (Lr*Zi[i] + Li*Zr[i]) * m;
+              }
+            }
+          });
+
+      for (int k = 0; k != 4; ++k) {
+        for (int i = 0; i != B; ++i)
+          s0[k][i] /= rho[i];
+        SphOp::template sph2cart<B>(rho, ct, st, cp, sp,
+                                    s0[k], s1[k], s2[k]);
+      }
+
+      // u = (phi_0, phi_1, phi_2) - sum_j t_j grad phi_j + grad phi_3
+      for (int i = 0; i != nb; ++i, ++t_block, ++r_first) {
+        const point_type& t = *t_block;
+        auto&& r = *r_first;
+        r[0] += pot[0][i] + s0[3][i] - (t[0]*s0[0][i] + t[1]*s0[1][i] +
+                                        t[2]*s0[2][i]);
+        r[1] += pot[1][i] + s1[3][i] - (t[0]*s1[0][i] + t[1]*s1[1][i] +
+                                        t[2]*s1[2][i]);
+        r[2] += pot[2][i] + s2[3][i] - (t[0]*s2[0][i] + t[1]*s2[1][i] +
+                                        t[2]*s2[2][i]);
+      }
+    }
+  }
+};
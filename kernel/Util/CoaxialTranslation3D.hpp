@@ -0,0 +1,286 @@
+#pragma once
+/** @file CoaxialTranslation3D.hpp
+ * @brief Translations of spherical expansions by rotation and a coaxial
+ * translation computed by quadrature.
+ *
+ * Some kernels have the expansions of SphericalMultipole3D, but with the
+ * powers rho^n and rho^{-n-1} of Z_n^m and W_n^m replaced by other radial
+ * functions R_n(rho) and S_n(rho), such as the modified spherical Bessel
+ * functions of the Yukawa kernel. Their translations along the z-axis have
+ * no closed form. A translation along z still only couples coefficients
+ * of equal order m, so it is a (P-m)x(P-m) matrix per order m. Here these
+ * matrices are computed by projecting the translated basis functions onto
+ * the Legendre functions of the basis at the new center. The projection
+ * uses Gauss-Legendre quadrature on a sphere about the new center.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+/** The data of a translation t of order P: the rotation that takes the
+ * z-axis to t, as in SphericalMultipole3D::Translation, and the coaxial
+ * matrices of the regular-to-regular (M2M, L2L) and singular-to-regular
+ * (M2L) translations by |t| in the normalized coefficients of
+ * SphericalMultipole3D::rotate_to_frame.
+ *
+ * @tparam point_type  The 3D point type.
+ * @tparam value_type  The type of the radial functions, real or complex.
+ */
+template <typename point_type,
+          typename value_type = typename point_type::value_type>
+struct CoaxialTranslation3D {
+  typedef typename point_type::value_type  real_type;
+  typedef std::complex<real_type>          complex_type;
+
+  //! Quadrature nodes beyond 2P, enough to push the aliasing of the
+  //! projections below round-off
+  static constexpr int EXTRA_NODES = 32;
+
+  //! The matrices to compute
+  enum { REGULAR = 1, SINGULAR = 2 };
+
+  //! The order of the matrices
+  int P;
+  real_type rho;
+  //! e^{i m alpha} and e^{i m beta}
+  std::vector<complex_type> ea, eb;
+  //! Per order m, the (P-m)x(P-m) row-major matrices C^m_{nk} that map the
+  //! basis function of degree n at the old center to degree k at the new.
+  //! Empty unless REGULAR and SINGULAR are requested, respectively.
+  std::vector<value_type> RR, SR;
+
+  /** @param[in] t     The vector from the old to the new center.
+   *  @param[in] reg   reg(r, N, f) sets f[n] = R_n(r) for all n < N.
+   *  @param[in] sing  sing(r, N, f) sets f[n] = S_n(r) for all n < N.
+   *  @param[in] dr    Zero if no R_n(r) vanishes for r > 0. Otherwise a
+   *                   distance in r over which no R_n has two zeros.
+   *  @param[in] which REGULAR for RR, SINGULAR for SR, or both.
+   */
+  template <typename Regular, typename Singular>
+  CoaxialTranslation3D(int _P, const point_type& t,
+                       Regular&& reg, Singular&& sing,
+                       real_type dr = 0, int which = REGULAR | SINGULAR)
+      : P(_P), rho(norm_2(t)),
+        ea(P, complex_type(1)), eb(P, complex_type(1)),
+        RR((which & REGULAR) ? offset(P, P) : 0),
+        SR((which & SINGULAR) ? offset(P, P) : 0) {
+    using std::sqrt;
+    if (rho == 0) {
+      for (int m = 0; m != P && !RR.empty(); ++m)
+        for (int n = m; n != P; ++n)
+          RR[offset(P, m) + (n-m)*(P-m) + (n-m)] = 1;
+      return;
+    }
+
+    const real_type rxy = sqrt(t[0]*t[0] + t[1]*t[1]);
+    const complex_type a = (rxy > 0) ? complex_type(t[0],t[1]) / rxy : 1;
+    const complex_type b = complex_type(t[2], rxy) / rho;
+    for (int m = 1; m < P; ++m) {
+      ea[m] = ea[m-1] * a;
+      eb[m] = eb[m-1] * b;
+    }
+
+    // On the sphere of radius rho/2 the singular functions of the old
+    // center are smooth, and the regular functions of the new center are
+    // not too small to divide by unless they are near a zero.
+    const Quadrature quad(P);
+    const real_type r = rho / 2;
+    std::vector<value_type> g(P);
+    reg(r, P, g.data());
+    if (!RR.empty())
+      project(quad, r, g, reg, false, RR);
+    if (!SR.empty())
+      project(quad, r, g, sing, true, SR);
+
+    // Take the columns k with R_k(r) near a zero from a second sphere
+    if (dr > 0 && r > 2*dr) {
+      using std::abs;
+      std::vector<value_type> g2(P), C2(offset(P, P));
+      reg(r - dr, P, g2.data());
+      for (int i = 0; i != 2; ++i) {
+        std::vector<value_type>& C = (i == 0) ? RR : SR;
+        if (C.empty())
+          continue;
+        if (i == 0)
+          project(quad, r - dr, g2, reg, false, C2);
+        else
+          project(quad, r - dr, g2, sing, true, C2);
+        for (int m = 0; m != P; ++m) {
+          const int o = offset(P, m), Nm = P - m;
+          for (int k = m; k != P; ++k)
+            if (abs(g2[k]) > abs(g[k]))
+              for (int n = m; n != P; ++n)
+                C[o + (n-m)*Nm + (k-m)] = C2[o + (n-m)*Nm + (k-m)];
+        }
+      }
+    }
+  }
+
+  /** Y_n^m = sum_k C^m_{nk} X_k^m, or sum_k C^m_{kn} X_k^m if transpose,
+   * for all 0 <= m <= n < P */
+  static void apply(int P, const value_type* C,
+                    const complex_type* X, complex_type* Y, bool transpose) {
+    for (int m = 0; m != P; ++m) {
+      const value_type* Cm = C + offset(P, m);
+      const int Nm = P - m;
+      // The strides of C^m in n and in k
+      const int sn = transpose ? 1 : Nm;
+      const int sk = transpose ? Nm : 1;
+      for (int n = m; n != P; ++n) {
+        const value_type* Cmn = Cm + (n-m)*sn - m*sk;
+        complex_type y = 0;
+        for (int k = m; k != P; ++k)
+          y += Cmn[k*sk] * X[k*(k+1)/2 + m];
+        Y[n*(n+1)/2 + m] = y;
+      }
+    }
+  }
+
+  //! The offset of the matrix of order m
+  static int offset(int P, int m) {
+    int o = 0;
+    for (int j = 0; j != m; ++j)
+      o += (P-j)*(P-j);
+    return o;
+  }
+
+ private:
+  /** The Q-point Gauss-Legendre rule on [-1,1] for the projections of
+   * order P, with the Legendre functions of the new center at its nodes */
+  struct Quadrature {
+    int P, Q;
+    //! Nodes and weights
+    std::vector<real_type> x, w;
+    //! The coefficients of the recurrence of Pbar_n^m at [m*P+n]
+    std::vector<real_type> a, b;
+    //! Pbar_k^m(x[q]) at [q*P*P + m*P + k]
+    std::vector<real_type> Pk;
+
+    explicit Quadrature(int _P)
+        : P(_P), Q(2*P + EXTRA_NODES), x(Q), w(Q), a(P*P), b(P*P),
+          Pk(Q*P*P) {
+      using std::sqrt;
+      gauss_legendre(Q, x.data(), w.data());
+      for (int m = 0; m != P; ++m) {
+        if (m > 0)
+          a[m*P + m] = sqrt(real_type(2*m-1) / (2*m));
+        if (m+1 != P)
+          a[m*P + m+1] = sqrt(real_type(2*m+1));
+        for (int n = m+2; n < P; ++n) {
+          const real_type d = sqrt(real_type((n-m)*(n+m)));
+          a[m*P + n] = (2*n-1) / d;
+          b[m*P + n] = sqrt(real_type((n+m-1)*(n-m-1))) / d;
+        }
+      }
+      for (int q = 0; q != Q; ++q)
+        legendre(x[q], sqrt(1 - x[q]*x[q]), Pk.data() + q*P*P);
+    }
+
+    /** The associated Legendre functions without the Condon-Shortley
+     * phase, normalized so that int_{-1}^{1} Pbar_n^m(x)^2 dx = 2/(2n+1),
+     *   Pbar[m*P+n] = sqrt((n-m)!/(n+m)!) P_n^m(x)
+     * for all 0 <= m <= n < P, with s = sqrt(1-x^2).
+     */
+    void legendre(real_type x, real_type s, real_type* Pbar) const {
+      real_type pmm = 1;
+      for (int m = 0; m != P; ++m) {
+        const real_type* am = a.data() + m*P;
+        const real_type* bm = b.data() + m*P;
+        real_type* Pm = Pbar + m*P;
+        if (m > 0)
+          pmm *= s * am[m];
+        Pm[m] = pmm;
+        if (m+1 == P)
+          break;
+        real_type p0 = pmm;
+        real_type p1 = x * am[m+1] * pmm;
+        Pm[m+1] = p1;
+        for (int n = m+2; n != P; ++n) {
+          const real_type p2 = x * am[n] * p1 - bm[n] * p0;
+          p0 = p1;
+          p1 = p2;
+          Pm[n] = p1;
+        }
+      }
+    }
+  };
+
+  /** The coaxial matrices
+   *   C^m_{nk} = s_n (2k+1) / (2 g[k])
+   *              int_{-1}^{1} f_n(r') Pbar_n^m(cos theta') Pbar_k^m(mu) dmu
+   * where the point a = r (sin theta, 0, mu) on the sphere about the new
+   * center is a + rho z = r' (sin theta', 0, cos theta') about the old, and
+   * s_n = (-1)^n for the singular functions, the sign of W_n^m, and
+   * g[k] = R_k(r).
+   */
+  template <typename F>
+  void project(const Quadrature& quad, real_type r,
+               const std::vector<value_type>& g,
+               F&& f, bool singular, std::vector<value_type>& C) const {
+    using std::sqrt;
+    std::fill(C.begin(), C.end(), value_type(0));
+    std::vector<real_type> Pn(P*P);
+    std::vector<value_type> fn(P);
+
+    for (int q = 0; q != quad.Q; ++q) {
+      const real_type mu = quad.x[q];
+      const real_type st = sqrt(1 - mu*mu);
+      const real_type z  = r*mu + rho;
+      const real_type rp = sqrt(r*r*st*st + z*z);
+      quad.legendre(z / rp, r*st / rp, Pn.data());
+      f(rp, P, fn.data());
+      const real_type* Pk = quad.Pk.data() + q*P*P;
+
+      for (int m = 0; m != P; ++m) {
+        value_type* Cm = C.data() + offset(P, m);
+        const real_type* Pkm = Pk + m*P;
+        const real_type* Pnm = Pn.data() + m*P;
+        const int Nm = P - m;
+        for (int n = m; n != P; ++n) {
+          const real_type s = (singular && (n & 1)) ? -quad.w[q] : quad.w[q];
+          const value_type c = fn[n] * (s * Pnm[n]);
+          value_type* Cmn = Cm + (n-m)*Nm - m;
+          for (int k = m; k != P; ++k)
+            Cmn[k] += c * Pkm[k];
+        }
+      }
+    }
+
+    for (int m = 0; m != P; ++m) {
+      value_type* Cm = C.data() + offset(P, m);
+      const int Nm = P - m;
+      for (int k = m; k != P; ++k) {
+        const value_type s = real_type(2*k+1) / (real_type(2) * g[k]);
+        for (int n = m; n != P; ++n)
+          Cm[(n-m)*Nm + (k-m)] *= s;
+      }
+    }
+  }
+
+  /** The Q-point Gauss-Legendre nodes x and weights w on [-1,1] */
+  static void gauss_legendre(int Q, real_type* x, real_type* w) {
+    for (int i = 0; i < (Q+1)/2; ++i) {
+      real_type z = std::cos(M_PI * (i + real_type(0.75)) / (Q + 0.5));
+      real_type dp = 1;
+      for (int iter = 0; iter != 100; ++iter) {
+        // P_Q(z) by the three-term recurrence, and its derivative
+        real_type p0 = 1, p1 = z;
+        for (int j = 2; j <= Q; ++j) {
+          const real_type p2 = ((2*j-1) * z * p1 - (j-1) * p0) / j;
+          p0 = p1;
+          p1 = p2;
+        }
+        dp = Q * (z*p1 - p0) / (z*z - 1);
+        const real_type dz = p1 / dp;
+        z -= dz;
+        if (std::abs(dz) < 1e-15)
+          break;
+      }
+      x[i] = z;
+      x[Q-1-i] = -z;
+      w[i] = w[Q-1-i] = 2 / ((1 - z*z) * dp * dp);
+    }
+  }
+};
@@ -1,10 +1,19 @@
 #pragma once
 
 #include <cmath>
+#include <algorithm>
+#include <vector>
 
+#include "fmmtl/config.hpp"
 #include "fmmtl/numeric/Complex.hpp"
 
-/** TODO: Documentation
+/** The spherical harmonic expansions and translations of the Laplace
+ * kernel in 3D, in the half storage n*(n+1)/2+m for 0 <= m <= n < P.
+ *
+ * The order P of the operators is an int, or an Order with a constexpr
+ * conversion to int such as std::integral_constant<int,P>. With the
+ * latter, the loop bounds and stack buffers of each operator are
+ * compile-time constants.
  */
 template <typename point_type,
           typename multipole_type,
@@ -15,6 +24,12 @@ struct SphericalMultipole3D {
   //! complex_type
   typedef std::complex<real_type>          complex_type;
 
+  //! Number of targets evaluated together by the vector L2T
+  static constexpr int L2T_BLOCK = 4 * FMMTL_SIMD_WIDTH;
+  //! Lowest orders at which the translations are done by rotation
+  static constexpr int M2L_ROTATION_ORDER = 4;
+  static constexpr int M2M_ROTATION_ORDER = 8;   // And L2L
+
   //! (-1)^n
   inline static constexpr real_type neg1pow(int n) {
     return ((n & 1) ? -1 : 1);
@@ -23,9 +38,9 @@ struct SphericalMultipole3D {
   /** Kernel S2M operation
    * M += Op(s) * c where M is the multipole and s is the source
    */
-  template <typename charge_type>
+  template <typename Order, typename charge_type>
   inline static
-  void S2M(int P, const point_type& translation, const charge_type& charge,
+  void S2M(Order P, const point_type& translation, const charge_type& charge,
            multipole_type& M) {
     real_type rho, theta, phi;
     cart2sph(rho, theta, phi, translation);
@@ -39,18 +54,148 @@ struct SphericalMultipole3D {
     }
   }
 
+  /** The data of a translation t for the M2M, M2L, and L2L of order P.
+   * Above the crossover orders: the rotation R = R_z(alpha) R_y(beta) that
+   * takes the z-axis to the direction of t, as the powers e^{i m alpha} and
+   * e^{i m beta} for m < P, and the coefficients of the translation along
+   * the axis. Below them: the harmonics Z_n^m(t) and W_n^m(t).
+   */
+  struct Translation {
+    real_type rho;
+    //! e^{i m alpha} and e^{i m beta}
+    std::vector<complex_type> ea, eb;
+    //! rho^j / j! for j < P and (-1)^j j! / rho^{j+1} for j < 2P
+    std::vector<real_type> h, g;
+    //! Z_n^m(t) for n < P and W_n^m(t) for n < 2P
+    std::vector<complex_type> Z, W;
+
+    Translation(int P, const point_type& t)
+        : rho(norm_2(t)) {
+      using std::sqrt;
+      if (P >= M2L_ROTATION_ORDER) {
+        // Computed without trigonometric functions
+        const real_type rxy = sqrt(t[0]*t[0] + t[1]*t[1]);
+        const complex_type a = (rxy > 0) ? complex_type(t[0],t[1]) / rxy : 1;
+        const complex_type b = complex_type(t[2], rxy) / rho;
+        ea.resize(P);
+        eb.resize(P);
+        ea[0] = eb[0] = 1;
+        for (int m = 1; m < P; ++m) {
+          ea[m] = ea[m-1] * a;
+          eb[m] = eb[m-1] * b;
+        }
+        g.resize(2*P);
+        g[0] = 1 / rho;
+        for (int j = 1; j < 2*P; ++j)
+          g[j] = -g[j-1] * j / rho;
+      }
+      if (P >= M2M_ROTATION_ORDER) {
+        h.resize(P);
+        h[0] = 1;
+        for (int j = 1; j < P; ++j)
+          h[j] = h[j-1] * rho / j;
+      }
+      real_type r, theta, phi;
+      cart2sph(r, theta, phi, t);
+      if (P < M2M_ROTATION_ORDER) {
+        Z.resize(P*(P+1)/2);
+        evalZ(r, theta, phi, P, Z.data());
+      }
+      if (P < M2L_ROTATION_ORDER) {
+        W.resize(P*(2*P+1));
+        evalW(r, theta, phi, 2*P, W.data());
+      }
+    }
+  };
+
   /** Kernel M2M operator
    * M_t += Op(M_s) where M_t is the target and M_s is the source
    */
+  template <typename Order>
   inline static
-  void M2M(int P,
+  void M2M(Order P,
            const multipole_type& Msource,
            multipole_type& Mtarget,
            const point_type& translation) {
-    real_type rho, theta, phi;
-    cart2sph(rho, theta, phi, translation);
-    complex_type Z[P*(P+1)/2];
-    evalZ(rho, theta, phi, P, Z);
+    M2M(P, Msource, Mtarget, Translation(P, translation));
+  }
+  template <typename Order>
+  inline static
+  void M2M(Order P,
+           const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const Translation& T) {
+    if (P >= M2M_ROTATION_ORDER)
+      M2M_rotate(P, Msource, Mtarget, T);
+    else
+      M2M_direct(P, Msource, Mtarget, T);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] Msource The multpole expansion source
+   * @param[in,out] Ltarget The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  template <typename Order>
+  inline static
+  void M2L(Order P,
+           const multipole_type& Msource,
+           local_type& Ltarget,
+           const point_type& translation) {
+    M2L(P, Msource, Ltarget, Translation(P, translation));
+  }
+  template <typename Order>
+  inline static
+  void M2L(Order P,
+           const multipole_type& Msource,
+           local_type& Ltarget,
+           const Translation& T) {
+    if (P >= M2L_ROTATION_ORDER)
+      M2L_rotate(P, Msource, Ltarget, T);
+    else
+      M2L_direct(P, Msource, Ltarget, T);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  template <typename Order>
+  inline static
+  void L2L(Order P,
+           const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) {
+    L2L(P, Lsource, Ltarget, Translation(P, translation));
+  }
+  template <typename Order>
+  inline static
+  void L2L(Order P,
+           const local_type& Lsource,
+           local_type& Ltarget,
+           const Translation& T) {
+    if (P >= M2M_ROTATION_ORDER)
+      L2L_rotate(P, Lsource, Ltarget, T);
+    else
+      L2L_direct(P, Lsource, Ltarget, T);
+  }
+
+  /** M2M by the addition theorem for Z_n^m, O(P^4) */
+  template <typename Order>
+  inline static
+  void M2M_direct(Order P,
+                  const multipole_type& Msource,
+                  multipole_type& Mtarget,
+                  const Translation& T) {
+    const complex_type* Z = T.Z.data();
     int nm = 0;   // n*(n+1)/2+m
     for (int n = 0; n != P; ++n) {
       for (int m = 0; m <= n; ++m, ++nm) {
@@ -91,24 +236,14 @@ struct SphericalMultipole3D {
     }
   }
 
-  /** Kernel M2L operation
-   * L += Op(M)
-   *
-   * @param[in] Msource The multpole expansion source
-   * @param[in,out] Ltarget The local expansion target
-   * @param[in] translation The vector from source to target
-   * @pre translation obeys the multipole-acceptance criteria
-   * @pre Msource includes the influence of all points within its box
-   */
+  /** M2L by the addition theorem for W_n^m, O(P^4) */
+  template <typename Order>
   inline static
-  void M2L(int P,
-           const multipole_type& Msource,
-           local_type& Ltarget,
-           const point_type& translation) {
-    real_type rho, theta, phi;
-    cart2sph(rho, theta, phi, translation);
-    complex_type W[P*(2*P+1)];
-    evalW(rho, theta, phi, 2*P, W);
+  void M2L_direct(Order P,
+                  const multipole_type& Msource,
+                  local_type& Ltarget,
+                  const Translation& T) {
+    const complex_type* W = T.W.data();
     int nm = 0;    // n*(n+1)/2 + m
     for (int n = 0; n != P; ++n) {
       for (int m = 0; m <= n; ++m, ++nm) {
@@ -148,23 +283,14 @@ struct SphericalMultipole3D {
     }
   }
 
-  /** Kernel L2L operator
-   * L_t += Op(L_s) where L_t is the target and L_s is the source
-   *
-   * @param[in] source The local source at the parent level
-   * @param[in,out] target The local target to accumulate into
-   * @param[in] translation The vector from source to target
-   * @pre Lsource includes the influence of all points outside its box
-   */
+  /** L2L by the addition theorem for Z_n^m, O(P^4) */
+  template <typename Order>
   inline static
-  void L2L(int P,
-           const local_type& Lsource,
-           local_type& Ltarget,
-           const point_type& translation) {
-    real_type rho, theta, phi;
-    cart2sph(rho, theta, phi, translation);
-    complex_type Z[P*(P+1)/2];
-    evalZ(rho, theta, phi, P, Z);
+  void L2L_direct(Order P,
+                  const local_type& Lsource,
+                  local_type& Ltarget,
+                  const Translation& T) {
+    const complex_type* Z = T.Z.data();
     int nm = 0;    // n*(n+1)/2 + m
     for (int n = 0; n != P; ++n) {
       for (int m = 0; m <= n; ++m, ++nm) {
@@ -206,6 +332,320 @@ struct SphericalMultipole3D {
   }
 
 
+  /** M2M by rotation, O(P^3).
+   * The coefficients are rotated to a frame with the translation along z,
+   * translated along the axis, where only the orders m of equal value
+   * couple, and rotated back.
+   */
+  template <typename Order>
+  inline static
+  void M2M_rotate(Order P,
+                  const multipole_type& Msource,
+                  multipole_type& Mtarget,
+                  const Translation& T) {
+    const RotationTable& R = rotation_table(P);
+    const real_type* h = T.h.data();
+
+    complex_type X[P*(P+1)/2], Y[P*(P+1)/2];
+    for (int c = 0; c != components(Msource); ++c) {
+      rotate_to_frame(R, T, P, Msource, c, false, X);
+
+      // M_n^m = sum_j rho^j/j! M_{n-j}^m
+      for (int n = 0; n != P; ++n) {
+        const int n0 = n*(n+1)/2;
+        for (int m = 0; m <= n; ++m) {
+          complex_type y = 0;
+          for (int j = 0; j <= n-m; ++j) {
+            const int k = n - j;
+            y += (h[j] * R.inorm[k][m]) * X[k*(k+1)/2 + m];
+          }
+          Y[n0 + m] = R.norm[n][m] * y;
+        }
+      }
+
+      rotate_from_frame(R, T, P, Y, false, Mtarget, c);
+    }
+  }
+
+  /** M2L by rotation, O(P^3). See M2M_rotate. */
+  template <typename Order>
+  inline static
+  void M2L_rotate(Order P,
+                  const multipole_type& Msource,
+                  local_type& Ltarget,
+                  const Translation& T) {
+    const RotationTable& R = rotation_table(P);
+    const real_type* g = T.g.data();
+
+    complex_type X[P*(P+1)/2], Y[P*(P+1)/2];
+    for (int c = 0; c != components(Msource); ++c) {
+      rotate_to_frame(R, T, P, Msource, c, false, X);
+
+      // L_n^m = (-1)^m sum_j (-1)^{j+n} (j+n)!/rho^{j+n+1} M_j^m
+      for (int j = 0; j != P; ++j)
+        for (int m = 0; m <= j; ++m)
+          X[j*(j+1)/2 + m] *= R.inorm[j][m];
+      for (int n = 0; n != P; ++n) {
+        const int n0 = n*(n+1)/2;
+        for (int m = 0; m <= n; ++m) {
+          complex_type y = 0;
+          for (int j = m; j != P; ++j)
+            y += g[j+n] * X[j*(j+1)/2 + m];
+          Y[n0 + m] = (neg1pow(m) * R.inorm[n][m]) * y;
+        }
+      }
+
+      rotate_from_frame(R, T, P, Y, true, Ltarget, c);
+    }
+  }
+
+  /** L2L by rotation, O(P^3). See M2M_rotate. */
+  template <typename Order>
+  inline static
+  void L2L_rotate(Order P,
+                  const local_type& Lsource,
+                  local_type& Ltarget,
+                  const Translation& T) {
+    const RotationTable& R = rotation_table(P);
+    const real_type* h = T.h.data();
+
+    complex_type X[P*(P+1)/2], Y[P*(P+1)/2];
+    for (int c = 0; c != components(Lsource); ++c) {
+      rotate_to_frame(R, T, P, Lsource, c, true, X);
+
+      // L_n^m = sum_j rho^{j-n}/(j-n)! L_j^m
+      for (int n = 0; n != P; ++n) {
+        const int n0 = n*(n+1)/2;
+        for (int m = 0; m <= n; ++m) {
+          complex_type y = 0;
+          for (int j = n; j != P; ++j)
+            y += (h[j-n] * R.norm[j][m]) * X[j*(j+1)/2 + m];
+          Y[n0 + m] = R.inorm[n][m] * y;
+        }
+      }
+
+      rotate_from_frame(R, T, P, Y, true, Ltarget, c);
+    }
+  }
+
+
+  /** Rotation matrices and normalizations of each degree n.
+   *
+   * The rotations act on the normalized coefficients
+   *   i^m N_n^m M_n^m   and   i^-m L_n^m / N_n^m,   N_n^m = sqrt((n+m)!(n-m)!)
+   * which transform under a rotation as the (conjugate) spherical harmonics
+   * of degree n, by the unitary Wigner matrices. A rotation about the
+   * y-axis by beta is factored as
+   *   d^n(beta) = i^-m d^n(pi/2)^T e^{i m beta} d^n(pi/2) i^m
+   * so the only tables are the real matrices d^n(pi/2), stored reduced
+   * to act on the coefficients with m >= 0. By the symmetry
+   * v_n^{-m} = (-1)^m conj(v_n^m), entry (k,m) of the reduced matrix
+   * maps the real part of v_m to the real part of v_k when n+k+m is even
+   * and the imaginary part to the imaginary part when n+k+m is odd.
+   */
+  struct RotationTable {
+    //! d^n(pi/2) and its transpose, reduced, (n+1)x(n+1) row-major
+    std::vector<std::vector<real_type> > d, dt;
+    //! N_n^m and 1/N_n^m
+    std::vector<std::vector<real_type> > norm, inorm;
+
+    //! Add the tables of all degrees n < P
+    void grow(int P) {
+      for (int n = d.size(); n < P; ++n) {
+        const std::vector<double> D = wigner_half_pi(n);
+        const int N = 2*n+1;
+        d.emplace_back((n+1)*(n+1));
+        dt.emplace_back((n+1)*(n+1));
+        for (int k = 0; k <= n; ++k) {
+          for (int m = 0; m <= n; ++m) {
+            // Coefficient of v_m and of v_{-m} = (-1)^m conj(v_m)
+            const double a = D[(k+n)*N + (m+n)];
+            const double b = (m == 0) ? 0 : neg1pow(m) * D[(k+n)*N + (n-m)];
+            d.back()[k*(n+1) + m] = ((n+k+m) & 1) ? a - b : a + b;
+            const double at = D[(m+n)*N + (k+n)];
+            const double bt = (m == 0) ? 0 : neg1pow(m) * D[(n-m)*N + (k+n)];
+            dt.back()[k*(n+1) + m] = ((n+k+m) & 1) ? at - bt : at + bt;
+          }
+        }
+        norm.emplace_back(n+1);
+        inorm.emplace_back(n+1);
+        for (int m = 0; m <= n; ++m) {
+          double f = 1;
+          for (int k = 2; k <= n+m; ++k) f *= k;
+          for (int k = 2; k <= n-m; ++k) f *= k;
+          norm.back()[m]  = std::sqrt(f);
+          inorm.back()[m] = 1 / std::sqrt(f);
+        }
+      }
+    }
+
+    /** The Wigner matrix d^n(pi/2), (2n+1)x(2n+1) indexed by (m'+n, m+n).
+     * Computed as exp(pi/2 G) for the generator G = -i J_y by scaling and
+     * squaring, which is stable for all n, unlike the explicit sum.
+     */
+    static std::vector<double> wigner_half_pi(int n) {
+      const int N = 2*n+1;
+      std::vector<double> G(N*N), E(N*N), T(N*N), S(N*N);
+      for (int m = -n; m <= n; ++m) {
+        if (m < n)
+          G[(m+1+n)*N + (m+n)] = -std::sqrt(double((n-m)*(n+m+1))) / 2;
+        if (m > -n)
+          G[(m-1+n)*N + (m+n)] =  std::sqrt(double((n+m)*(n-m+1))) / 2;
+      }
+      // Scale so that |G| < 1/4, where 16 Taylor terms are exact
+      int s = 0;
+      double scale = M_PI / 2;
+      while (n * scale > 0.25) {
+        scale /= 2;
+        ++s;
+      }
+      for (int i = 0; i < N; ++i)
+        E[i*N + i] = T[i*N + i] = 1;
+      for (int k = 1; k <= 16; ++k) {
+        matmul(N, T, G, S);
+        for (int i = 0; i < N*N; ++i) {
+          T[i] = S[i] * scale / k;
+          E[i] += T[i];
+        }
+      }
+      for ( ; s > 0; --s) {
+        matmul(N, E, E, S);
+        E.swap(S);
+      }
+      return E;
+    }
+
+    //! C = A * B for N x N row-major matrices
+    static void matmul(int N, const std::vector<double>& A,
+                       const std::vector<double>& B, std::vector<double>& C) {
+      std::fill(C.begin(), C.end(), 0.0);
+      for (int i = 0; i < N; ++i)
+        for (int k = 0; k < N; ++k)
+          for (int j = 0; j < N; ++j)
+            C[i*N + j] += A[i*N + k] * B[k*N + j];
+    }
+  };
+
+  /** The rotation tables of all degrees n < P. Each thread builds its own
+   * on first use, so the table is never shared while it grows.
+   */
+  inline static
+  const RotationTable& rotation_table(int P) {
+    static thread_local RotationTable table;
+    table.grow(P);
+    return table;
+  }
+
+  //! i^m z
+  inline static complex_type mul_ipow(int m, const complex_type& z) {
+    switch (m & 3) {
+      case 0: return z;
+      case 1: return complex_type(-z.imag(), z.real());
+      case 2: return -z;
+      default: return complex_type(z.imag(), -z.real());
+    }
+  }
+
+  //! The number of complex components of each expansion coefficient
+  template <typename Expansion>
+  inline static constexpr int components(const Expansion&) {
+    return sizeof(typename Expansion::value_type) / sizeof(complex_type);
+  }
+  //! The c-th complex component of an expansion coefficient
+  inline static complex_type& component(complex_type& z, int) {
+    return z;
+  }
+  inline static const complex_type& component(const complex_type& z, int) {
+    return z;
+  }
+  template <typename V>
+  inline static auto component(V&& v, int c) -> decltype(v[c]) {
+    return v[c];
+  }
+
+  /** Reduced d^n(pi/2) (or its transpose) times u, see RotationTable */
+  inline static
+  void apply_half_pi(int n, const real_type* D,
+                     const complex_type* u, complex_type* w) {
+    for (int k = 0; k <= n; ++k, D += n+1) {
+      real_type re = 0, im = 0;
+      int m = (n+k) & 1;
+      for (int mr = m; mr <= n; mr += 2)
+        re += D[mr] * u[mr].real();
+      for (int mi = 1-m; mi <= n; mi += 2)
+        im += D[mi] * u[mi].imag();
+      w[k] = complex_type(re, im);
+    }
+  }
+
+  /** v <- post d^n(beta) pre v for the coefficients v of degree n, where
+   * pre and post are diagonal phases, or identity if null, and
+   * eb[k] = e^{i k beta}, conjugated if conj_b.
+   */
+  inline static
+  void rotate(const RotationTable& R, int n,
+              const complex_type* pre, const complex_type* eb, bool conj_b,
+              const complex_type* post, complex_type* v) {
+    complex_type u[n+1], w[n+1];
+    u[0] = v[0];
+    for (int m = 1; m <= n; ++m)
+      u[m] = mul_ipow(m, v[m]);
+    if (pre)
+      for (int m = 1; m <= n; ++m)
+        u[m] *= pre[m];
+    apply_half_pi(n, R.d[n].data(), u, w);
+    for (int k = 1; k <= n; ++k)
+      w[k] *= conj_b ? conj(eb[k]) : eb[k];
+    apply_half_pi(n, R.dt[n].data(), w, u);
+    for (int m = 0; m <= n; ++m)
+      v[m] = mul_ipow(-m, u[m]);
+    if (post)
+      for (int m = 1; m <= n; ++m)
+        v[m] *= conj(post[m]);
+  }
+
+  /** Normalizes the c-th component of the expansion E into X,
+   *   X_n^m = i^m N_n^m M_n^m  or  X_n^m = i^-m L_n^m / N_n^m  if is_local,
+   * and rotates X from the original frame into the frame of the
+   * translation T, where T is along the z-axis.
+   *
+   * T is a Translation or any type with the rotation powers ea and eb.
+   */
+  template <typename Order, typename Frame, typename Expansion>
+  inline static
+  void rotate_to_frame(const RotationTable& R, const Frame& T, Order P,
+                       const Expansion& E, int c, bool is_local,
+                       complex_type* X) {
+    for (int n = 0; n != P; ++n) {
+      complex_type* Xn = X + n*(n+1)/2;
+      for (int m = 0; m <= n; ++m) {
+        const complex_type& e = component(E[n*(n+1)/2 + m], c);
+        Xn[m] = is_local ? mul_ipow(-m, e * R.inorm[n][m])
+                         : mul_ipow(m, e * R.norm[n][m]);
+      }
+      rotate(R, n, T.ea.data(), T.eb.data(), true, nullptr, Xn);
+    }
+  }
+
+  /** Rotates X from the frame of T back to the original frame and adds the
+   * denormalized coefficients to the c-th component of E.
+   */
+  template <typename Order, typename Frame, typename Expansion>
+  inline static
+  void rotate_from_frame(const RotationTable& R, const Frame& T, Order P,
+                         complex_type* X, bool is_local,
+                         Expansion& E, int c) {
+    for (int n = 0; n != P; ++n) {
+      complex_type* Xn = X + n*(n+1)/2;
+      rotate(R, n, nullptr, T.eb.data(), false, T.ea.data(), Xn);
+      for (int m = 0; m <= n; ++m) {
+        complex_type& e = component(E[n*(n+1)/2 + m], c);
+        e += is_local ? mul_ipow(m, Xn[m] * R.norm[n][m])
+                      : mul_ipow(-m, Xn[m] * R.inorm[n][m]);
+      }
+    }
+  }
+
   /** Spherical to cartesian coordinates */
   inline static
   point_type sph2cart(real_type rho, real_type theta, real_type phi,
@@ -262,8 +702,9 @@ struct SphericalMultipole3D {
    * harmonics with the prefactor (often denoted A_n^m) included. These are useful
    * for computing multipole and local expansions in an FMM.
    */
+  template <typename Order>
   inline static
-  void evalZ(real_type rho, real_type theta, real_type phi, int P,
+  void evalZ(real_type rho, real_type theta, real_type phi, Order P,
              complex_type* Y, complex_type* dY = nullptr) {
     typedef real_type     real;
     typedef complex_type  complex;
@@ -402,4 +843,138 @@ struct SphericalMultipole3D {
     }                                               // End loop over m in Wnm
   }
 
+  /** Cartesian to spherical coordinates of a block of points in lanes.
+   * Computes rho and the sines and cosines of theta and phi directly,
+   * without inverse trigonometric functions.
+   *
+   * @param[in]  n      The number of points, 0 < n <= B. The lanes past n
+   *                      repeat the first point.
+   * @param[in]  x,y,z  The cartesian coordinates of the points.
+   * @param[out] rho,ct,st,cp,sp  The radius, cos and sin of theta, and
+   *                      cos and sin of phi of each lane.
+   */
+  template <int B>
+  inline static
+  void cart2sph(int n, real_type* x, real_type* y, real_type* z,
+                real_type* rho, real_type* ct, real_type* st,
+                real_type* cp, real_type* sp) {
+    using std::sqrt;
+    for (int i = n; i < B; ++i) {
+      x[i] = x[0];
+      y[i] = y[0];
+      z[i] = z[0];
+    }
+    for (int i = 0; i < B; ++i) {
+      const real_type rxy2 = x[i]*x[i] + y[i]*y[i];
+      const real_type rxy  = sqrt(rxy2);
+      rho[i] = sqrt(rxy2 + z[i]*z[i]);
+      const real_type ir = 1 / (rho[i] + real_type(1e-100));
+      ct[i] = z[i] * ir;
+      st[i] = rxy * ir;
+      // phi = atan2(y,x) = 0 on the z-axis
+      const real_type ixy = (rxy2 > 0) ? 1 / rxy : 0;
+      cp[i] = (rxy2 > 0) ? x[i] * ixy : 1;
+      sp[i] = y[i] * ixy;
+    }
+  }
+
+  /** Spherical to cartesian coordinates of a vector in each lane.
+   * @param[in,out] s0,s1,s2  The (rho, theta, phi) components of the vector
+   *                            on input and its (x, y, z) components on output.
+   */
+  template <int B>
+  inline static
+  void sph2cart(const real_type* rho, const real_type* ct, const real_type* st,
+                const real_type* cp, const real_type* sp,
+                real_type* s0, real_type* s1, real_type* s2) {
+    for (int i = 0; i < B; ++i) {
+      const real_type a = s0[i]*st[i] + s1[i]*ct[i]/rho[i];
+      const real_type b = s2[i]/(rho[i]*st[i]);
+      const real_type c = s0[i]*ct[i] - s1[i]*st[i]/rho[i];
+      s0[i] = a*cp[i] - b*sp[i];
+      s1[i] = a*sp[i] + b*cp[i];
+      s2[i] = c;
+    }
+  }
+
+  /** Computes Z_n^m (see evalZ) and its theta-derivative at a block of B
+   * points, one point per lane, so each step of the recurrences is a
+   * vector operation across the lanes. For each 0 <= m <= n < P, calls
+   *   f(n, m, nm, Zr, Zi, dZr, dZi)
+   * where nm = n*(n+1)/2+m and Zr, Zi, dZr, dZi are arrays of B values with
+   * the real and imaginary parts of Z_n^m and its theta-derivative.
+   *
+   * @param[in] rho,ct,st,cp,sp  The lanes from the cart2sph above.
+   */
+  template <int B, typename Order, typename Function>
+  inline static
+  void evalZ(Order P,
+             const real_type* rho, const real_type* ct, const real_type* st,
+             const real_type* cp, const real_type* sp,
+             Function&& f) {
+    real_type ist[B];                             // 1 / sin(theta)
+    real_type Pmm[B], rhom[B], er[B], ei[B];      // Pmm, rho^m/(2m)!, eim
+    real_type Pnm[B], Pn1m[B], rhon[B];
+    real_type Zr[B], Zi[B], dZr[B], dZi[B];
+    for (int i = 0; i < B; ++i) {
+      ist[i]  = 1 / st[i];
+      Pmm[i]  = 1;
+      rhom[i] = 1;
+      er[i]   = 1;
+      ei[i]   = 0;
+    }
+
+    for (int m = 0; m < P; ++m) {
+      // n == m
+      int nm = m*(m+1)/2 + m;
+      for (int i = 0; i < B; ++i) {
+        const real_type a = rhom[i] * Pmm[i];
+        const real_type d = (m == 0) ? 0 : m * ct[i] * ist[i];
+        Zr[i]  = a * er[i];
+        Zi[i]  = a * ei[i];
+        dZr[i] = d * Zr[i];
+        dZi[i] = d * Zi[i];
+      }
+      f(m, m, nm, Zr, Zi, dZr, dZi);
+
+      // m < n < P with P_{m-1}^m = 0
+      for (int i = 0; i < B; ++i) {
+        Pn1m[i] = 0;
+        Pnm[i]  = Pmm[i];
+        rhon[i] = rhom[i];
+      }
+      for (int n = m+1; n < P; ++n) {
+        nm += n;
+        const real_type a = real_type(2*n-1) / (n-m);
+        const real_type b = real_type(n+m-1) / (n-m);
+        const real_type c = real_type(1) / (n+m);
+        for (int i = 0; i < B; ++i) {
+          const real_type Pn2m = Pn1m[i];
+          Pn1m[i] = Pnm[i];
+          Pnm[i]  = a * ct[i] * Pn1m[i] - b * Pn2m;   // P_n^m recurrence
+          rhon[i] *= rho[i] * c;                      // rho^n / (n+m)!
+          const real_type z = rhon[i] * Pnm[i];
+          const real_type d = rhon[i] * ist[i] *
+              (n * ct[i] * Pnm[i] - (n+m) * Pn1m[i]);
+          Zr[i]  = z * er[i];
+          Zi[i]  = z * ei[i];
+          dZr[i] = d * er[i];
+          dZi[i] = d * ei[i];
+        }
+        f(n, m, nm, Zr, Zi, dZr, dZi);
+      }
+
+      // Advance to m+1
+      const real_type a = real_type(1) / ((2*m+2)*(2*m+1));
+      for (int i = 0; i < B; ++i) {
+        rhom[i] *= rho[i] * a;                        // rho^m / (2m)!
+        Pmm[i]  *= -st[i] * (2*m+1);                  // P_m^m recurrence
+        // eim *= exp(i*phi) i^-1
+        const real_type r = er[i]*sp[i] + ei[i]*cp[i];
+        ei[i] = ei[i]*sp[i] - er[i]*cp[i];
+        er[i] = r;
+      }
+    }
+  }
+
 };
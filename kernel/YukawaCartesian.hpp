@@ -4,84 +4,57 @@
  *
  * K(t,s) = exp(-Kappa*|t-s|) / |t-s|                           // Potential
  * K(t,s) = -(Kappa*|t-s|+1) exp(-Kappa*|t-s|) (t-s) / |t-s|^3  // Force
+ *
+ * The coefficients n = (i,j,k), |n| = i+j+k <= P, of the expansions are
+ * stored in lexicographic order, see index(i,j,k). The multipoles hold the
+ * scaled moments sum q (c-s)^n / n! and the locals hold the derivatives
+ * D^n phi(c) of the potential at the center of the box.
  */
 
-#include <complex>
+#include <cmath>
 #include <vector>
-#include <cassert>
 
 #include "Yukawa.kern"
 
 #include "fmmtl/Expansion.hpp"
 #include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
 
 class YukawaCartesian
     : public fmmtl::Expansion<YukawaKernel, YukawaCartesian> {
  protected:
   typedef double real;
-  typedef std::complex<real> complex;
-  typedef std::vector<real> real_vec;
-  struct IndexCache;
 
   //! Expansion order
   const int P;
   //! number of multipole terms
-  unsigned MTERMS;
-
-  //! I, J, K arrays
-  std::vector<unsigned> I, J, K;
-  //! indices of multipole terms
-  std::vector<unsigned> index;
-  //! factorial cache
-  std::vector<double> fact;
-
- protected:
-  //! Store all possible index combinations returned from setIndex
-  // TODO: Static/Analytic computation
-  struct IndexCache {
-   private:
-    unsigned setIndex(unsigned i, unsigned j, unsigned k) const {
-      unsigned II = 0;
-      for (unsigned ii = 0; ii < i; ++ii)
-        for (unsigned jj = 1; jj < P_+2-ii; ++jj)
-          II += jj;
-      for (unsigned jj = P_+2-j; jj < P_+2; ++jj)
-        II += jj-i;
-      return II + k;
-    }
-
-    // use 1D vector & index into it
-    std::vector<unsigned> indices;
-    unsigned P_;
-
-   public:
-    IndexCache(unsigned P)
-        : P_(P) {
-      indices = std::vector<unsigned>((P_+1)*(P_+1)*(P_+1),0);
-      for (unsigned i=0; i<P_+1; i++) {
-        for (unsigned j=0; j<P_+1-i; j++) {
-          for (unsigned k=0; k<P_+1-i-j; k++) {
-            indices[i*(P_+1)*(P_+1)+j*(P_+1) + k] = setIndex(i,j,k);
-          }
-        }
-      }
-    }
-
-    inline unsigned operator()(unsigned i, unsigned j, unsigned k) const {
-      return indices[i*(P_+1)*(P_+1)+j*(P_+1)+k];
-    }
-  };
+  int MTERMS;
 
-  IndexCache index_cache;
+  //! 1/k for 0 < k <= P
+  std::vector<real> inv;
+  //! n! = i! j! k! of each term n = (i,j,k)
+  std::vector<real> fact;
 
  public:
   //! Point type to use for the trees
   typedef Vec<3,real> point_type;
 
   //! Multipole expansion type
-  typedef std::vector<real> multipole_type;
+  typedef fmmtl::ExpansionVector<real> multipole_type;
   //! Local expansion type
-  typedef std::vector<real> local_type;
+  typedef fmmtl::ExpansionVector<real> local_type;
+
+  //! Number of sources or targets evaluated together by the vector S2M, L2T
+  static constexpr int BLOCK = 2 * FMMTL_SIMD_WIDTH;
+
+  /** Precomputed translation data, see fmmtl::TranslationCache */
+  struct Translation {
+    //! t^n / n! for the M2M and L2L
+    std::vector<real> X;
+    //! D^n f(t) for the M2L
+    std::vector<real> D;
+  };
+  typedef Translation translation_type;
 
   //! Default constructor - use delegating constructor
   YukawaCartesian()
@@ -90,40 +63,29 @@ class YukawaCartesian
   //! Constructor
   YukawaCartesian(int p, double _kappa)
       : Expansion(YukawaKernel(_kappa)),
-        P(p), MTERMS((P+1)*(P+2)*(P+3)/6), fact(2*P), index_cache(P) {
-    //kappa = _kappa;  // Sets the YukawaKernel kappa
-
-    I = std::vector<unsigned>(MTERMS,0);
-    J = std::vector<unsigned>(MTERMS,0);
-    K = std::vector<unsigned>(MTERMS,0);
-    index = std::vector<unsigned>(MTERMS,0);
-
-    // generate n -> (i,j,k) arrays
-    unsigned idx=0;
-    for (int ii=0; ii<P+1; ii++) {
-      for (int jj=0; jj<P+1-ii; jj++) {
-        for (int kk=0; kk<P+1-ii-jj; kk++) {
-          index[idx] = index_cache(ii,jj,kk);
-          I[idx] = ii;
-          J[idx] = jj;
-          K[idx] = kk;
-          idx++;
-        }
-      }
-    }
-
-    // generate factorials
-    fact[0] = 1;
-    for (int i=1; i<2*P; i++) fact[i] = i*fact[i-1];
+        P(p), MTERMS((P+1)*(P+2)*(P+3)/6), inv(P+1), fact(MTERMS) {
+    for (int k = 1; k <= P; ++k)
+      inv[k] = real(1) / k;
+
+    std::vector<real> f(P+1);
+    f[0] = 1;
+    for (int k = 1; k <= P; ++k)
+      f[k] = k * f[k-1];
+
+    int n = 0;
+    for (int i = 0; i <= P; ++i)
+      for (int j = 0; j <= P-i; ++j)
+        for (int k = 0; k <= P-i-j; ++k, ++n)
+          fact[n] = f[i] * f[j] * f[k];
   }
 
   /** Initialize a multipole expansion with the size of a box at this level */
   void init_multipole(multipole_type& M, const point_type&, unsigned) const {
-    M = std::vector<real>((P+1)*(P+2)*(P+3)/6, 0);
+    M.assign(MTERMS, real(0));
   }
   /** Initialize a local expansion with the size of a box at this level */
   void init_local(local_type& L, const point_type&, unsigned) const {
-    L = std::vector<real>((P+1)*(P+2)*(P+3)/6, 0);
+    L.assign(MTERMS, real(0));
   }
 
   /** Kernel S2M operation
@@ -136,14 +98,34 @@ class YukawaCartesian
    */
   void S2M(const source_type& source, const charge_type& charge,
            const point_type& center, multipole_type& M) const {
-    point_type dX = center - source;
+    S2M_block<1>(&source, &source + 1, &charge, center, M);
+  }
 
-    for (unsigned i = 0; i < MTERMS; ++i) {
-      double fact_term = fact[I[i]]*fact[J[i]]*fact[K[i]];
-      M[i] += charge * pow(dX[0],I[i])
-                     * pow(dX[1],J[i])
-                     * pow(dX[2],K[i]) / fact_term;
-    }
+  /** Kernel vectorized S2M operation
+   * M += sum_i Op(s_i) * c_i, the sources are evaluated in blocks of BLOCK
+   *
+   * @param[in] s_first,s_last Iterator range to the sources
+   * @param[in] c_first Iterator to the charges of the sources
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  template <typename SourceIter, typename ChargeIter>
+  void S2M(SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+           const point_type& center, multipole_type& M) const {
+    S2M_block<BLOCK>(s_first, s_last, c_first, center, M);
+  }
+
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    Translation T;
+    T.X.resize(MTERMS);
+    T.D.resize(MTERMS);
+    monomials<1>(&translation[0], &translation[1], &translation[2],
+                 T.X.data());
+    derivatives(translation, T.D.data());
+    return T;
   }
 
   /** Kernel M2M operator
@@ -157,23 +139,15 @@ class YukawaCartesian
   void M2M(const multipole_type& Msource,
                  multipole_type& Mtarget,
            const point_type& translation) const {
-    const unsigned MTERMS = (P+1)*(P+2)*(P+3)/6;
-    const auto dX = translation;
-
-    for (unsigned i=0; i<MTERMS; ++i) {
-      unsigned n[3] = {I[i], J[i], K[i]};
-
-      for (unsigned ii=0; ii<n[0]+1; ii++) {
-        for (unsigned jj=0; jj<n[1]+1; jj++) {
-          for (unsigned kk=0; kk<n[2]+1; kk++) {
-
-            unsigned Midx = index_cache(ii,jj,kk);
-            double fact_term = fact[n[0]-ii]*fact[n[1]-jj]*fact[n[2]-kk];
-            Mtarget[i] += Msource[Midx]*pow(dX[0],n[0]- ii)*pow(dX[1],n[1]-jj)*pow(dX[2],n[2]-kk)/fact_term;
-          }
-        }
-      }
-    }
+    real X[MTERMS];
+    monomials<1>(&translation[0], &translation[1], &translation[2], X);
+    product(Msource.data(), X, Mtarget.data());
+  }
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+                 multipole_type& Mtarget,
+           const translation_type& T) const {
+    product(Msource.data(), T.X.data(), Mtarget.data());
   }
 
   /** Kernel M2T operation
@@ -187,21 +161,32 @@ class YukawaCartesian
    */
   void M2T(const multipole_type& M, const point_type& center,
            const target_type& target, result_type& result) const {
-    std::vector<real> a_aux(MTERMS,0), ax_aux(MTERMS,0), ay_aux(MTERMS,0), az_aux(MTERMS,0);
-
-    point_type dX = target - center;
-
-    getCoeff(a_aux, ax_aux, ay_aux, az_aux, dX);
-
-    // loop over tarSize
-    for (unsigned j=0; j<MTERMS; j++) {
-      double fact_term = fact[I[j]]*fact[J[j]]*fact[K[j]];
-
-      result[0] +=  a_aux[j]*M[j]*fact_term;
-      result[1] += ax_aux[j]*M[j]*fact_term;
-      result[2] += ay_aux[j]*M[j]*fact_term;
-      result[3] += az_aux[j]*M[j]*fact_term;
+    real D[MTERMS];
+    derivatives(target - center, D);
+
+    // phi = sum_n D^n f M[n] and grad phi = sum_n D^{n+e_d} f M[n]
+    real pot = 0, gx = 0, gy = 0, gz = 0;
+    for (int i = 0; i <= P; ++i) {
+      for (int j = 0; j <= P-i; ++j) {
+        const int r = index(i,j,0);
+        const int K = P-i-j;
+        for (int k = 0; k <= K; ++k)
+          pot += D[r+k] * M[r+k];
+        if (K == 0)
+          continue;
+        const int rx = index(i+1,j,0);
+        const int ry = index(i,j+1,0);
+        for (int k = 0; k < K; ++k) {
+          gx += D[rx+k]  * M[r+k];
+          gy += D[ry+k]  * M[r+k];
+          gz += D[r+k+1] * M[r+k];
+        }
+      }
     }
+    result[0] += pot;
+    result[1] += gx;
+    result[2] += gy;
+    result[3] += gz;
   }
 
   /** Kernel M2L operation
@@ -216,42 +201,15 @@ class YukawaCartesian
   void M2L(const multipole_type& Msource,
                  local_type& Ltarget,
            const point_type& translation) const {
-    std::vector<real> a_aux(MTERMS,0), ax_aux(MTERMS,0), ay_aux(MTERMS,0), az_aux(MTERMS,0);
-
-    getCoeff(a_aux, ax_aux, ay_aux, az_aux, translation);
-
-    // get rid of factorial terms from getCoeff
-    for (unsigned i=0; i<MTERMS; i++) {
-      a_aux[i] *= fact[I[i]]*fact[J[i]]*fact[K[i]];
-    }
-
-    for (int ik=0; ik<P+1; ik++) {
-      for (int jk=0; jk<P+1-ik; jk++) {
-        for (int kk=0; kk<P+1-ik-jk; kk++) {
-          // k = (ik, jk, kk)
-          int Lk  = index_cache(ik,jk,kk);
-          //
-          for (int in=0; in<P+1-ik; in++) {
-            // printf("in: %d\n",in);
-            for (int jn=0; jn<P+1-jk; jn++) {
-              for (int kn=0; kn<P+1-kk; kn++) {
-
-                if (in+jn+kn > P) continue;
-                if (in+ik+jn+jk+kn+kk > P) continue;
-                //     n = (in, jn, kn)
-                // (n+k) = (ik+in, jk+jn, kk+kn)
-                // L_k   = \sum_{n=0}^{p-k} a_aux[getIndex(n+k)]*M[getIndex(n)]
-                //
-                int Mn  = index_cache(in,jn,kn);
-                int npk = index_cache(ik+in,jk+jn,kk+kn);
-
-                Ltarget[Lk] += a_aux[npk] * Msource[Mn];
-              }
-            }
-          } // end inner loop
-        }
-      }
-    } // end outer loop
+    real D[MTERMS];
+    derivatives(translation, D);
+    contract(D, Msource.data(), Ltarget.data());
+  }
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+                 local_type& Ltarget,
+           const translation_type& T) const {
+    contract(T.D.data(), Msource.data(), Ltarget.data());
   }
 
   /** Kernel L2L operation
@@ -265,21 +223,15 @@ class YukawaCartesian
   void L2L(const local_type& Lsource,
                  local_type& Ltarget,
            const point_type& translation) const {
-    for (unsigned i=0; i<MTERMS; i++) {
-      // n = (I[i], J[i], K[i])
-      unsigned n[3] = {I[i],J[i],K[i]};
-      for (int ii=I[i]; ii<P+1; ii++) {
-        for (int jj=J[i]; jj<P+1-ii; jj++) {
-          for (int kk=K[i]; kk<P+1-ii-jj; kk++) {
-            // k = (ii, jj, kk)
-            int Lk = index_cache(ii,jj,kk);
-
-            double fact_term = fact[ii-n[0]]*fact[jj-n[1]]*fact[kk-n[2]];
-            Ltarget[i] += Lsource[Lk]*pow(translation[0],ii-n[0])*pow(translation[1],jj-n[1])*pow(translation[2],kk-n[2]) / fact_term;
-          }
-        }
-      }
-    }
+    real X[MTERMS];
+    monomials<1>(&translation[0], &translation[1], &translation[2], X);
+    contract(Lsource.data(), X, Ltarget.data());
+  }
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+                 local_type& Ltarget,
+           const translation_type& T) const {
+    contract(Lsource.data(), T.X.data(), Ltarget.data());
   }
 
   /** Kernel L2T operation
@@ -293,342 +245,234 @@ class YukawaCartesian
    */
   void L2T(const local_type& L, const point_type& center,
            const target_type& target, result_type& result) const {
-    auto dx = target-center;
+    L2T_block<1>(L, center, &target, &target + 1, &result);
+  }
 
-    for (unsigned i=0; i<MTERMS; i++) {
-      unsigned k[3] = {I[i], J[i], K[i]};
-      // calculate potential
-      double phi = L[i]*pow(dx[0],k[0])*pow(dx[1],k[1])*pow(dx[2],k[2]) / (fact[k[0]]*fact[k[1]]*fact[k[2]]);
-      result[0] += phi;
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i), the targets are evaluated in blocks of BLOCK
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    L2T_block<BLOCK>(L, center, t_first, t_last, r_first);
+  }
 
-      double inv[3];
-      for (int i=0; i<3; i++) inv[i] = (fabs(dx[i]) < 1e-12) ? 0 : 1. / dx[i];
+ protected:
+  /** The position of the term n = (i,j,k), |n| <= P, in the lexicographic
+   * order of the coefficients. The terms (i,j,0..P-i-j) are contiguous. */
+  int index(int i, int j, int k) const {
+    const int q = P + 1 - i;
+    return MTERMS - q*(q+1)*(q+2)/6 + j*(2*q-j+1)/2 + k;
+  }
 
-      // using potential, calculate derivatives
-      result[1] += phi * k[0] * inv[0];
-      result[2] += phi * k[1] * inv[1];
-      result[3] += phi * k[2] * inv[2];
+  /** The scaled monomials X[n*B+l] = x_l^n / n! for |n| <= P of B points,
+   * each from a lower one with a single multiply */
+  template <int B>
+  void monomials(const real* x, const real* y, const real* z,
+                 real* X) const {
+    for (int l = 0; l < B; ++l)
+      X[l] = 1;
+    for (int i = 0; i <= P; ++i) {
+      if (i > 0) {
+        real*       Xi = X + index(i,0,0) * B;
+        const real* Xp = X + index(i-1,0,0) * B;
+        for (int l = 0; l < B; ++l)
+          Xi[l] = Xp[l] * x[l] * inv[i];
+      }
+      for (int j = 0; j <= P-i; ++j) {
+        real* Xj = X + index(i,j,0) * B;
+        if (j > 0) {
+          const real* Xp = X + index(i,j-1,0) * B;
+          for (int l = 0; l < B; ++l)
+            Xj[l] = Xp[l] * y[l] * inv[j];
+        }
+        for (int k = 1; k <= P-i-j; ++k)
+          for (int l = 0; l < B; ++l)
+            Xj[k*B+l] = Xj[(k-1)*B+l] * z[l] * inv[k];
+      }
     }
   }
 
- protected:
-  // get coefficients given by d^n / dx^n f(x)
-  void getCoeff(real_vec& a, real_vec& ax, real_vec& ay, real_vec& az,
-                const point_type& dX) const
-  {
-    real_vec b(a.size(),0);
-    real dx = dX[0], dy = dX[1], dz = dX[2];
-
-    auto R2 = norm_2_sq(dX);
-    auto R  = sqrt(R2);
-
-    int i,j,k,I,Im1x,Im2x,Im1y,Im2y,Im1z,Im2z;
-    real C,C1,C2,Cb, R2_1;
-
-    R2_1 = 1/R2;
-
-    // First coefficient
-    b[0] = exp(-kappa*R);
-    a[0] = b[0]/R;
-
-    // Two indices = 0
-    I = index_cache(1,0,0); // setIndex(P,1,0,0);
-    b[I]   = -kappa * (dx*a[0]); // 1,0,0
-    b[P+1] = -kappa * (dy*a[0]); // 0,1,0
-    b[1]   = -kappa * (dz*a[0]); // 0,0,1
-
-    a[I]   = -R2_1*dx*(kappa*b[0]+a[0]);
-    a[P+1] = -R2_1*dy*(kappa*b[0]+a[0]);
-    a[1]   = -R2_1*dz*(kappa*b[0]+a[0]);
-
-    ax[0]  = a[I];
-    ay[0]  = a[P+1];
-    az[0]  = a[1];
-
-    for (i=2; i<P+1; i++)
-    {
-      Cb   = -kappa/i;
-      C    = R2_1/i;
-      I    = index_cache(i,0,0); // setIndex(P,i,0,0);
-      Im1x = index_cache(i-1,0,0); // setIndex(P,i-1,0,0);
-      Im2x = index_cache(i-2,0,0); // setIndex(P,i-2,0,0);
-      b[I] = Cb * (dx*a[Im1x] + a[Im2x]);
-      a[I] = C * ( -kappa*(dx*b[Im1x] + b[Im2x]) -(2*i-1)*dx*a[Im1x] - (i-1)*a[Im2x] );
-      ax[Im1x] = a[I]*i;
-
-      I    = index_cache(0,i,0); // setIndex(P,0,i,0);
-      Im1y = I-(P+2-i);
-      Im2y = Im1y-(P+2-i+1);
-      b[I] = Cb * (dy*a[Im1y] + a[Im2y]);
-      a[I] = C * ( -kappa*(dy*b[Im1y] + b[Im2y]) -(2*i-1)*dy*a[Im1y] - (i-1)*a[Im2y] );
-      ay[Im1y] = a[I]*i;
-
-      I   = i;
-      Im1z = I-1;
-      Im2z = I-2;
-      b[I] = Cb * (dz*a[Im1z] + a[Im2z]);
-      a[I] = C * ( -kappa*(dz*b[Im1z] + b[Im2z]) -(2*i-1)*dz*a[Im1z] - (i-1)*a[Im2z] );
-      az[Im1z] = a[I]*i;
+  /** The derivatives D[n] = D^n f(x) for |n| <= P of the potential
+   * f = exp(-kappa R) / R, by the recurrence of the Taylor coefficients
+   * a[n] = D^n f / n! with the auxiliary b[n] = D^n exp(-kappa R) / n! */
+  void derivatives(const point_type& x, real* D) const {
+    real* a = D;
+    real b[MTERMS];
+
+    const real R2 = norm_2_sq(x);
+    const real R  = std::sqrt(R2);
+    const real invR2 = 1 / R2;
+
+    b[0] = std::exp(-kappa * R);
+    a[0] = b[0] / R;
+
+    for (int i = 0; i <= P; ++i) {
+      for (int j = 0; j <= P-i; ++j) {
+        const int r   = index(i,j,0);
+        const int rx1 = (i >= 1) ? index(i-1,j,0) : 0;
+        const int rx2 = (i >= 2) ? index(i-2,j,0) : 0;
+        const int ry1 = (j >= 1) ? index(i,j-1,0) : 0;
+        const int ry2 = (j >= 2) ? index(i,j-2,0) : 0;
+        for (int k = (i+j == 0); k <= P-i-j; ++k) {
+          const int n = i + j + k;
+          // The terms of n - e_d and of n - 2e_d
+          real a1 = 0, b1 = 0, a2 = 0, b2 = 0;
+          if (i >= 1) { a1 += x[0] * a[rx1+k];  b1 += x[0] * b[rx1+k]; }
+          if (i >= 2) { a2 += a[rx2+k];         b2 += b[rx2+k];        }
+          if (j >= 1) { a1 += x[1] * a[ry1+k];  b1 += x[1] * b[ry1+k]; }
+          if (j >= 2) { a2 += a[ry2+k];         b2 += b[ry2+k];        }
+          if (k >= 1) { a1 += x[2] * a[r+k-1];  b1 += x[2] * b[r+k-1]; }
+          if (k >= 2) { a2 += a[r+k-2];         b2 += b[r+k-2];        }
+
+          b[r+k] = -kappa * inv[n] * (a1 + a2);
+          a[r+k] = invR2 * inv[n] * (-kappa * (b1 + b2)
+                                     - (2*n-1) * a1 - (n-1) * a2);
+        }
+      }
     }
 
-    // One index = 0, one = 1 other >=1
-    Cb   = -kappa/2;
-    C    = R2_1/2.;
-    I    = index_cache(1,1,0); //setIndex(P,1,1,0);
-    Im1x = P+1;
-    Im1y = I-P;
-    b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y]);
-    a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]) - 3*(dx*a[Im1x]+dy*a[Im1y]) );
-    ax[Im1x] = a[I];
-    ay[Im1y] = a[I];
-    I    = index_cache(1,0,1); // setIndex(P,1,0,1);
-    Im1x = 1;
-    Im1z = I-1;
-    b[I] = Cb * (dx*a[Im1x] + dz*a[Im1z]);
-    a[I] = C * ( -kappa*(dx*b[Im1x]+dz*b[Im1z]) - 3*(dx*a[Im1x]+dz*a[Im1z]) );
-    ax[Im1x] = a[I];
-    az[Im1z] = a[I];
-    I    = index_cache(0,1,1); // setIndex(P,0,1,1);
-    Im1y = I-(P+1);
-    Im1z = I-1;
-    b[I] = Cb * (dy*a[Im1y] + dz*a[Im1z]);
-    a[I] = C * ( -kappa*(dy*b[Im1y]+dz*b[Im1z]) - 3*(dy*a[Im1y]+dz*a[Im1z]) );
-    ay[Im1y] = a[I];
-    az[Im1z] = a[I];
-
-    for (i=2; i<P; i++)
-    {
-      Cb   = -kappa/(i+1);
-      C    = R2_1/(1+i);
-      C1   = 1+2*i;
-      I    = index_cache(1,i,0); // setIndex(P,1,i,0);
-      Im1x = index_cache(0,i,0); // setIndex(P,0,i,0);
-      Im1y = I-(P+1-i);
-      Im2y = Im1y-(P+2-i);
-      b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + a[Im2y]);
-      a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+b[Im2y]) - C1*(dx*a[Im1x]+dy*a[Im1y]) - (1+i-1)*(a[Im2y]) );
-      ax[Im1x] = a[I];
-      ay[Im1y] = a[I]*i;
-
-      I    = index_cache(1,0,i); // setIndex(P,1,0,i);
-      Im1x = index_cache(0,0,i); // setIndex(P,0,0,i);
-      Im1z = I-1;
-      Im2z = I-2;
-      b[I] = Cb * (dx*a[Im1x] + dz*a[Im1z] + a[Im2z]);
-      a[I] = C * ( -kappa*(dx*b[Im1x]+dz*b[Im1z]+b[Im2z]) - C1*(dx*a[Im1x]+dz*a[Im1z]) - (1+i-1)*(a[Im2z]) );
-      ax[Im1x] = a[I];
-      az[Im1z] = a[I]*i;
-
-      I    = index_cache(0,1,i); // setIndex(P,0,1,i);
-      Im1y = I-(P+1);
-      Im1z = I-1;
-      Im2z = I-2;
-      b[I] = Cb * (dy*a[Im1y] + dz*a[Im1z] + a[Im2z]);
-      a[I] = C * ( -kappa*(dy*b[Im1y]+dz*b[Im1z]+b[Im2z]) - C1*(dy*a[Im1y]+dz*a[Im1z]) - (1+i-1)*(a[Im2z]) );
-      ay[Im1y] = a[I];
-      az[Im1z] = a[I]*i;
-
-      I    = index_cache(i,1,0); // setIndex(P,i,1,0);
-      Im1y = I-(P+1-i);
-      Im1x = index_cache(i-1,1,0); // setIndex(P,i-1,1,0);
-      Im2x = index_cache(i-2,1,0); // setIndex(P,i-2,1,0);
-      b[I] = Cb * (dy*a[Im1y] + dx*a[Im1x] + a[Im2x]);
-      a[I] = C * ( -kappa*(dy*b[Im1y]+dx*b[Im1x]+b[Im2x]) - C1*(dy*a[Im1y]+dx*a[Im1x]) - (1+i-1)*(a[Im2x]) );
-      ax[Im1x] = a[I]*i;
-      ay[Im1y] = a[I];
-
-      I    = index_cache(i,0,1); // setIndex(P,i,0,1);
-      Im1z = I-1;
-      Im1x = index_cache(i-1,0,1); // setIndex(P,i-1,0,1);
-      Im2x = index_cache(i-2,0,1); // setIndex(P,i-2,0,1);
-      b[I] = Cb * (dz*a[Im1z] + dx*a[Im1x] + a[Im2x]);
-      a[I] = C * ( -kappa*(dz*b[Im1z]+dx*b[Im1x]+b[Im2x]) - C1*(dz*a[Im1z]+dx*a[Im1x]) - (1+i-1)*(a[Im2x]) );
-      ax[Im1x] = a[I]*i;
-      az[Im1z] = a[I];
-
-      I    = index_cache(0,i,1); // setIndex(P,0,i,1);
-      Im1z = I-1;
-      Im1y = I-(P+2-i);
-      Im2y = Im1y-(P+3-i);
-      b[I] = Cb * (dz*a[Im1z] + dy*a[Im1y] + a[Im2y]);
-      a[I] = C * ( -kappa*(dz*b[Im1z]+dy*b[Im1y]+b[Im2y]) - C1*(dz*a[Im1z]+dy*a[Im1y]) - (1+i-1)*(a[Im2y]) );
-      ay[Im1y] = a[I]*i;
-      az[Im1z] = a[I];
-    }
+    for (int n = 0; n < MTERMS; ++n)
+      D[n] = a[n] * fact[n];
+  }
 
-    // One index 0, others >=2
-    for (i=2; i<P+1; i++)
-    {
-      for (j=2; j<P+1-i; j++)
-      {
-        Cb   = -kappa/(i+j);
-        C    = R2_1/(i+j);
-        C1   = 2*(i+j)-1;
-        I    = index_cache(i,j,0); // setIndex(P,i,j,0);
-        Im1x = index_cache(i-1,j,0); // setIndex(P,i-1,j,0);
-        Im2x = index_cache(i-2,j,0); // setIndex(P,i-2,j,0);
-        Im1y = I-(P+2-j-i);
-        Im2y = Im1y-(P+3-j-i);
-        b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + a[Im2x] + a[Im2y]);
-        a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+b[Im2x]+b[Im2y]) - C1*(dx*a[Im1x]+dy*a[Im1y]) -(i+j-1)*(a[Im2x]+a[Im2y]) );
-        ax[Im1x] = a[I]*i;
-        ay[Im1y] = a[I]*j;
-
-        I    = index_cache(i,0,j); // setIndex(P,i,0,j);
-        Im1x = index_cache(i-1,0,j); // setIndex(P,i-1,0,j);
-        Im2x = index_cache(i-2,0,j); // setIndex(P,i-2,0,j);
-        Im1z = I-1;
-        Im2z = I-2;
-        b[I] = Cb * (dx*a[Im1x] + dz*a[Im1z] + a[Im2x] + a[Im2z]);
-        a[I] = C * ( -kappa*(dx*b[Im1x]+dz*b[Im1z]+b[Im2x]+b[Im2z]) - C1*(dx*a[Im1x]+dz*a[Im1z]) -(i+j-1)*(a[Im2x]+a[Im2z]) );
-        ax[Im1x] = a[I]*i;
-        az[Im1z] = a[I]*j;
-
-        I    = index_cache(0,i,j); // setIndex(P,0,i,j);
-        Im1y = I-(P+2-i);
-        Im2y = Im1y-(P+3-i);
-        Im1z = I-1;
-        Im2z = I-2;
-        b[I] = Cb * (dy*a[Im1y] + dz*a[Im1z] + a[Im2y] + a[Im2z]);
-        a[I] = C * ( -kappa*(dy*b[Im1y]+dz*b[Im1z]+b[Im2y]+b[Im2z]) - C1*(dy*a[Im1y]+dz*a[Im1z]) -(i+j-1)*(a[Im2y]+a[Im2z]) );
-        ay[Im1y] = a[I]*i;
-        az[Im1z] = a[I]*j;
+  /** C[k+m] += A[k] * B[m] for |k|+|m| <= P */
+  void product(const real* A, const real* B, real* C) const {
+    int kn = 0;
+    for (int ik = 0; ik <= P; ++ik) {
+      for (int jk = 0; jk <= P-ik; ++jk) {
+        for (int kk = 0; kk <= P-ik-jk; ++kk, ++kn) {
+          const real Ak = A[kn];
+          const int Q = P-ik-jk-kk;
+          for (int im = 0; im <= Q; ++im) {
+            for (int jm = 0; jm <= Q-im; ++jm) {
+              real*       Cr = C + index(ik+im, jk+jm, kk);
+              const real* Br = B + index(im, jm, 0);
+              for (int km = 0; km <= Q-im-jm; ++km)
+                Cr[km] += Ak * Br[km];
+            }
+          }
+        }
       }
     }
+  }
 
-    if (P>2)
-    {
-      // Two index = 1, other>=1
-      C    = R2_1/3;
-      Cb   = -kappa/3;
-      I    = index_cache(1,1,1); // setIndex(P,1,1,1);
-      Im1x = index_cache(0,1,1); // setIndex(P,0,1,1);
-      Im1y = index_cache(1,0,1); // setIndex(P,1,0,1);
-      Im1y = I-(P);
-      Im1z = I-1;
-      b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z]);
-      a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]) - 5*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) );
-      ax[Im1x] = a[I];
-      ay[Im1y] = a[I];
-      az[Im1z] = a[I];
-      for (i=2; i<P-1; i++)
-      {
-        Cb   = -kappa/(2+i);
-        C    = R2_1/(i+2);
-        C1   = 2*i+3;
-        I    = index_cache(i,1,1); // setIndex(P,i,1,1);
-        Im1x = index_cache(i-1,1,1); // setIndex(P,i-1,1,1);
-        Im1y = I-(P+1-i);
-        Im1z = I-1;
-        Im2x = index_cache(i-2,1,1); // setIndex(P,i-2,1,1);
-        b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2x]);
-        a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2x]) - C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - (i+1)*(a[Im2x]) );
-        ax[Im1x] = a[I]*i;
-        ay[Im1y] = a[I];
-        az[Im1z] = a[I];
-
-        I    = index_cache(1,i,1); // setIndex(P,1,i,1);
-        Im1x = index_cache(0,i,1); // setIndex(P,0,i,1);
-        Im1y = I-(P+1-i);
-        Im2y = Im1y-(P+2-i);
-        Im1z = I-1 ;
-        b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2y]);
-        a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2y]) - C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - (i+1)*(a[Im2y]) );
-        ax[Im1x] = a[I];
-        ay[Im1y] = a[I]*i;
-        az[Im1z] = a[I];
-
-        I    = index_cache(1,1,i); // setIndex(P,1,1,i);
-        Im1x = index_cache(0,1,i); // setIndex(P,0,1,i);
-        Im1y = I-(P);
-        Im1z = I-1;
-        Im2z = I-2;
-        b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2z]);
-        a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2z]) - C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - (i+1)*(a[Im2z]) );
-        ax[Im1x] = a[I];
-        ay[Im1y] = a[I];
-        az[Im1z] = a[I]*i;
+  /** C[k] += sum_m A[k+m] * B[m] for |k|+|m| <= P */
+  void contract(const real* A, const real* B, real* C) const {
+    int kn = 0;
+    for (int ik = 0; ik <= P; ++ik) {
+      for (int jk = 0; jk <= P-ik; ++jk) {
+        for (int kk = 0; kk <= P-ik-jk; ++kk, ++kn) {
+          const int Q = P-ik-jk-kk;
+          real s = 0;
+          for (int im = 0; im <= Q; ++im) {
+            for (int jm = 0; jm <= Q-im; ++jm) {
+              const real* Ar = A + index(ik+im, jk+jm, kk);
+              const real* Br = B + index(im, jm, 0);
+              for (int km = 0; km <= Q-im-jm; ++km)
+                s += Ar[km] * Br[km];
+            }
+          }
+          C[kn] += s;
+        }
       }
     }
+  }
 
-    // One index = 1, others >=2
-    if (P>4)
-    {
-      for (i=2; i<P-2; i++)
-      {
-        for (j=2; j<P-i; j++)
-        {
-          Cb = -kappa/(1+i+j);
-          C  =  R2_1/(1+i+j);
-          C1 = -(2.*(i+j)+1);
-          C2 = (i+j);
-          I    = index_cache(1,i,j); // setIndex(P,1,i,j);
-          Im1x = index_cache(0,i,j); // setIndex(P,0,i,j);
-          Im1y = I-(P+1-i);
-          Im2y = Im1y-(P+2-i);
-          Im1z = I-1;
-          Im2z = I-2;
-          b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2y] + a[Im2z]);
-          a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2y]+b[Im2z]) + C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - C2*(a[Im2y]+a[Im2z]) );
-          ax[Im1x] = a[I];
-          ay[Im1y] = a[I]*i;
-          az[Im1z] = a[I]*j;
-
-          I    = index_cache(i,1,j); // setIndex(P,i,1,j);
-          Im1x = index_cache(i-1,1,j); // setIndex(P,i-1,1,j);
-          Im1y = I-(P+1-i);
-          Im2x = index_cache(i-2,1,j); // setIndex(P,i-2,1,j);
-          Im1z = I-1;
-          Im2z = I-2;
-          b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2x] + a[Im2z]);
-          a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2x]+b[Im2z]) + C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - C2*(a[Im2x]+a[Im2z]) );
-          ax[Im1x] = a[I]*i;
-          ay[Im1y] = a[I];
-          az[Im1z] = a[I]*j;
-
-          I    = index_cache(i,j,1); // setIndex(P,i,j,1);
-          Im1x = index_cache(i-1,j,1); // setIndex(P,i-1,j,1);
-          Im2x = index_cache(i-2,j,1); // setIndex(P,i-2,j,1);
-          Im1y = I-(P+2-i-j);
-          Im2y = Im1y-(P+3-i-j);
-          Im1z = I-1;
-          b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2x] + a[Im2y]);
-          a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2x]+b[Im2y]) + C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - C2*(a[Im2x]+a[Im2y]) );
-          ax[Im1x] = a[I]*i;
-          ay[Im1y] = a[I]*j;
-          az[Im1z] = a[I];
-        }
+  /** S2M of the sources in blocks of B, M[n] += sum_l q_l (c-s_l)^n / n! */
+  template <int B, typename SourceIter, typename ChargeIter>
+  void S2M_block(SourceIter s_first, SourceIter s_last, ChargeIter c_first,
+                 const point_type& center, multipole_type& M) const {
+    real x[B], y[B], z[B], q[B];
+    real X[MTERMS * B];
+
+    while (s_first != s_last) {
+      int nb = 0;
+      for ( ; nb != B && s_first != s_last; ++nb, ++s_first, ++c_first) {
+        const point_type d = center - *s_first;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+        q[nb] = *c_first;
+      }
+      for (int l = nb; l != B; ++l)
+        x[l] = y[l] = z[l] = q[l] = 0;
+
+      monomials<B>(x, y, z, X);
+
+      for (int n = 0; n < MTERMS; ++n) {
+        real s = 0;
+        for (int l = 0; l < B; ++l)
+          s += q[l] * X[n*B+l];
+        M[n] += s;
       }
     }
+  }
 
-    // All indices >= 2
-    if (P>5)
-    {
-      for (i=2;i<P-3;i++)
-      {
-        for (j=2;j<P-1-i;j++)
-        {
-          for (k=2;k<P+1-i-j;k++)
-          {
-            Cb = -kappa/(i+j+k);
-            C  = R2_1/(i+j+k);
-            C1 = -(2.*(i+j+k)-1);
-            C2 = i+j+k-1.;
-            I    = index_cache(i,j,k); // setIndex(P,i,j,k);
-            Im1x = index_cache(i-1,j,k); // setIndex(P,i-1,j,k);
-            Im2x = index_cache(i-2,j,k); // setIndex(P,i-2,j,k);
-            Im1y = I-(P+2-i-j);
-            Im2y = Im1y-(P+3-i-j);
-            Im1z = I-1;
-            Im2z = I-2;
-            b[I] = Cb * (dx*a[Im1x] + dy*a[Im1y] + dz*a[Im1z] + a[Im2x] + a[Im2y] + a[Im2z]);
-            a[I] = C * ( -kappa*(dx*b[Im1x]+dy*b[Im1y]+dz*b[Im1z]+b[Im2x]+b[Im2y]+b[Im2z]) + C1*(dx*a[Im1x]+dy*a[Im1y]+dz*a[Im1z]) - C2*(a[Im2x]+a[Im2y]+a[Im2z]) );
-            ax[Im1x] = a[I]*i;
-            ay[Im1y] = a[I]*j;
-            az[Im1z] = a[I]*k;
+  /** L2T of the targets in blocks of B, phi(t) = sum_n L[n] (t-c)^n / n!
+   * and d/dt_d phi(t) = sum_n L[n+e_d] (t-c)^n / n! */
+  template <int B, typename TargetIter, typename ResultIter>
+  void L2T_block(const local_type& L, const point_type& center,
+                 TargetIter t_first, TargetIter t_last,
+                 ResultIter r_first) const {
+    real x[B], y[B], z[B];
+    real pot[B], gx[B], gy[B], gz[B];
+    real X[MTERMS * B];
+
+    while (t_first != t_last) {
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      for (int l = nb; l != B; ++l)
+        x[l] = y[l] = z[l] = 0;
+
+      monomials<B>(x, y, z, X);
+
+      for (int l = 0; l < B; ++l)
+        pot[l] = gx[l] = gy[l] = gz[l] = 0;
+      for (int i = 0; i <= P; ++i) {
+        for (int j = 0; j <= P-i; ++j) {
+          const int r = index(i,j,0);
+          const int K = P-i-j;
+          for (int k = 0; k <= K; ++k) {
+            const real* Xn = X + (r+k) * B;
+            const real Ln = L[r+k];
+            for (int l = 0; l < B; ++l)
+              pot[l] += Ln * Xn[l];
+          }
+          if (K == 0)
+            continue;
+          const int rx = index(i+1,j,0);
+          const int ry = index(i,j+1,0);
+          for (int k = 0; k < K; ++k) {
+            const real* Xn = X + (r+k) * B;
+            const real Lx = L[rx+k], Ly = L[ry+k], Lz = L[r+k+1];
+            for (int l = 0; l < B; ++l) {
+              gx[l] += Lx * Xn[l];
+              gy[l] += Ly * Xn[l];
+              gz[l] += Lz * Xn[l];
+            }
           }
         }
       }
+
+      for (int l = 0; l != nb; ++l, ++r_first) {
+        auto&& res = *r_first;
+        res[0] += pot[l];
+        res[1] += gx[l];
+        res[2] += gy[l];
+        res[3] += gz[l];
+      }
     }
   }
 };
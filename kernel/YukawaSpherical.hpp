@@ -0,0 +1,312 @@
+#pragma once
+/** @file YukawaSpherical.hpp
+ * @brief Implements the Yukawa kernel with spherical expansions.
+ *
+ * K(t,s) = exp(-Kappa*|t-s|) / |t-s|                           // Potential
+ * K(t,s) = -(Kappa*|t-s|+1) exp(-Kappa*|t-s|) (t-s) / |t-s|^3  // Force
+ *
+ * With the scaled modified spherical Bessel functions
+ *   I_n(r) = i_n(kappa r) (2n+1)!! / kappa^n          -> r^n
+ *   K_n(r) = k_n(kappa r) (2/pi) kappa^{n+1} / (2n-1)!!  -> r^{-n-1}
+ * the kernel has the expansion, for |y| < |x|,
+ *   exp(-kappa |x-y|) / |x-y| = sum_n I_n(|y|) K_n(|x|) P_n(cos gamma)
+ * which is that of the Laplace kernel, to which it reduces as kappa -> 0.
+ * The expansions are those of SphericalMultipole3D with rho^n and
+ * rho^{-n-1} replaced by I_n and K_n, and the translations rotate to the
+ * z-axis with SphericalMultipole3D and translate along it with the
+ * matrices of CoaxialTranslation3D.
+ */
+
+#include <complex>
+#include <cmath>
+
+#include "fmmtl/Expansion.hpp"
+#include "fmmtl/numeric/Vec.hpp"
+#include "fmmtl/numeric/Complex.hpp"
+#include "fmmtl/numeric/ExpansionVector.hpp"
+
+#include "kernel/Util/SphericalMultipole3D.hpp"
+#include "kernel/Util/CoaxialTranslation3D.hpp"
+
+#include "Yukawa.kern"
+
+class YukawaSpherical
+    : public fmmtl::Expansion<YukawaKernel, YukawaSpherical> {
+ public:
+  typedef double real_type;
+  typedef std::complex<real_type> complex_type;
+
+  //! Point type
+  typedef Vec<3,real_type> point_type;
+
+  //! Multipole expansion type
+  typedef fmmtl::ExpansionVector<complex_type> multipole_type;
+  //! Local expansion type
+  typedef fmmtl::ExpansionVector<complex_type> local_type;
+
+  //! Harmonics and rotations
+  typedef SphericalMultipole3D<point_type,multipole_type,local_type> SphOp;
+
+  //! Precomputed translation data, see fmmtl::TranslationCache
+  typedef CoaxialTranslation3D<point_type> translation_type;
+
+  //! Expansion order
+  int P;
+
+  //! Constructor
+  YukawaSpherical(int _P = 5, double _kappa = 0.125)
+      : Expansion(YukawaKernel(_kappa)), P(_P) {
+  }
+
+  /** Initialize a multipole expansion with the size of a box at this level */
+  void init_multipole(multipole_type& M, const point_type&, unsigned) const {
+    M.assign(P*(P+1)/2, complex_type(0));
+  }
+  /** Initialize a local expansion with the size of a box at this level */
+  void init_local(local_type& L, const point_type&, unsigned) const {
+    L.assign(P*(P+1)/2, complex_type(0));
+  }
+
+  /** Kernel S2M operation
+   * M += Op(s) * c where M is the multipole and s is the source
+   *
+   * @param[in] source The point source
+   * @param[in] charge The source's corresponding charge
+   * @param[in] center The center of the box containing the multipole expansion
+   * @param[in,out] M The multipole expansion to accumulate into
+   */
+  void S2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    real_type rho, theta, phi;
+    SphOp::cart2sph(rho, theta, phi, center - source);
+    complex_type Z[P*(P+1)/2];
+    SphOp::evalZ(rho, theta, phi, P, Z);
+    real_type I[P];
+    bessel_i(kappa * rho, P, I);
+
+    int nm = 0;   // n*(n+1)/2+m
+    for (int n = 0; n != P; ++n) {
+      const real_type c = charge * I[n];
+      for (int m = 0; m <= n; ++m, ++nm)
+        M[nm] += SphOp::neg1pow(m) * conj(Z[nm]) * c;
+    }
+  }
+
+  /** Precompute the data of a translation for M2M, M2L, and L2L
+   * @param[in] translation The vector from source to target
+   */
+  translation_type make_translation(const point_type& translation) const {
+    return translation_type(P, translation,
+                            [this](real_type r, int N, real_type* f) {
+                              regular(r, N, f);
+                            },
+                            [this](real_type r, int N, real_type* f) {
+                              singular(r, N, f);
+                            });
+  }
+
+  /** Kernel M2M operator
+   * M_t += Op(M_s) where M_t is the target and M_s is the source
+   *
+   * @param[in] source The multipole source at the child level
+   * @param[in,out] target The multipole target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const point_type& translation) const {
+    M2M(Msource, Mtarget, make_translation(translation));
+  }
+  /** Kernel M2M with a precomputed translation */
+  void M2M(const multipole_type& Msource,
+           multipole_type& Mtarget,
+           const translation_type& T) const {
+    translate(T, T.RR.data(), false, Msource, false, Mtarget, false);
+  }
+
+  /** Kernel M2L operation
+   * L += Op(M)
+   *
+   * @param[in] Msource The multpole expansion source
+   * @param[in,out] Ltarget The local expansion target
+   * @param[in] translation The vector from source to target
+   * @pre translation obeys the multipole-acceptance criteria
+   * @pre Msource includes the influence of all points within its box
+   */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    M2L(Msource, Ltarget, make_translation(translation));
+  }
+  /** Kernel M2L with a precomputed translation */
+  void M2L(const multipole_type& Msource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    translate(T, T.SR.data(), true, Msource, false, Ltarget, true);
+  }
+
+  /** Kernel L2L operator
+   * L_t += Op(L_s) where L_t is the target and L_s is the source
+   *
+   * @param[in] source The local source at the parent level
+   * @param[in,out] target The local target to accumulate into
+   * @param[in] translation The vector from source to target
+   * @pre Lsource includes the influence of all points outside its box
+   */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const point_type& translation) const {
+    L2L(Lsource, Ltarget, make_translation(translation));
+  }
+  /** Kernel L2L with a precomputed translation */
+  void L2L(const local_type& Lsource,
+           local_type& Ltarget,
+           const translation_type& T) const {
+    translate(T, T.RR.data(), true, Lsource, true, Ltarget, true);
+  }
+
+  /** Kernel vectorized L2T operation
+   * r_i += Op(L, t_i) where L is the local expansion and r_i are the results
+   *
+   * The targets are evaluated in blocks of SphOp::L2T_BLOCK, one target per
+   * lane, as in LaplaceSpherical with the powers rho^n scaled by I_n/rho^n.
+   *
+   * @param[in] L The local expansion
+   * @param[in] center The center of the box with the local expansion
+   * @param[in] t_first,t_last Iterator range to the targets
+   * @param[in] r_first Iterator to the results to accumulate into
+   * @pre L includes the influence of all sources outside its box
+   */
+  template <typename TargetIter, typename ResultIter>
+  void L2T(const local_type& L, const point_type& center,
+           TargetIter t_first, TargetIter t_last, ResultIter r_first) const {
+    constexpr int B = SphOp::L2T_BLOCK;
+    real_type x[B], y[B], z[B];
+    real_type rho[B], ct[B], st[B], cp[B], sp[B];
+    real_type pot[B], s0[B], s1[B], s2[B], sr[B];
+    real_type I[(P+1)*B], Ii[P+1];
+    const real_type kappa2 = kappa * kappa;
+
+    while (t_first != t_last) {
+      int nb = 0;
+      for ( ; nb != B && t_first != t_last; ++nb, ++t_first) {
+        const point_type d = *t_first - center;
+        x[nb] = d[0];
+        y[nb] = d[1];
+        z[nb] = d[2];
+      }
+      SphOp::template cart2sph<B>(nb, x, y, z, rho, ct, st, cp, sp);
+
+      // I_n(rho) / rho^n for n <= P, degree P for the radial derivative
+      for (int i = 0; i != B; ++i) {
+        bessel_i(kappa * rho[i], P+1, Ii);
+        for (int n = 0; n <= P; ++n)
+          I[n*B + i] = Ii[n];
+      }
+
+      for (int i = 0; i != B; ++i)
+        pot[i] = s0[i] = s1[i] = s2[i] = sr[i] = 0;
+
+      SphOp::template evalZ<B>(P, rho, ct, st, cp, sp,
+          [&](int n, int m, int nm,
+              const real_type* Zr, const real_type* Zi,
+              const real_type* dZr, const real_type* dZi) {
+            // Z_n^{-m} = (-1)^m conj(Z_n^m) doubles the real part for m > 0
+            const real_type f  = (m == 0) ? 1 : 2;
+            const real_type Lr = f * L[nm].real();
+            const real_type Li = f * L[nm].imag();
+            const real_type* In  = I + n*B;
+            const real_type* In1 = I + (n+1)*B;
+            const real_type c = kappa2 / (2*n+3);
+            for (int i = 0; i != B; ++i) {
+              const real_type LZ = Lr*Zr[i] - Li*Zi[i];
+              pot[i] += In[i] * LZ;
+              s0[i]  += In[i] * LZ * n;
+              sr[i]  += In1[i] * LZ * c;
+              s1[i]  += In[i] * (Lr*dZr[i] - Li*dZi[i]);
+              s2[i]  -= In[i] * (Lr*Zi[i] + Li*Zr[i]) * m;
+            }
+          });
+
+      // d/drho (I_n/rho^n) = kappa^2 rho I_{n+1}/rho^{n+1} / (2n+3)
+      for (int i = 0; i != B; ++i)
+        s0[i] = s0[i] / rho[i] + sr[i] * rho[i];
+      SphOp::template sph2cart<B>(rho, ct, st, cp, sp, s0, s1, s2);
+
+      for (int i = 0; i != nb; ++i, ++r_first) {
+        auto&& r = *r_first;
+        r[0] += pot[i];
+        r[1] += s0[i];
+        r[2] += s1[i];
+        r[3] += s2[i];
+      }
+    }
+  }
+
+  /** The scaled modified spherical Bessel functions of the first kind,
+   *   I[n] = i_n(z) (2n+1)!! / z^n,  0 <= n < N,
+   * by the power series of the two highest degrees and the downward
+   * recurrence I[n-1] = I[n] + z^2 I[n+1] / ((2n+1)(2n+3)), which has no
+   * cancellation.
+   */
+  static void bessel_i(real_type z, int N, real_type* I) {
+    const real_type z2 = z * z;
+    auto series = [z2](int n) {
+      real_type s = 1, t = 1;
+      for (int k = 1; t > 1e-17 * s; ++k) {
+        t *= z2 / (2*k * (2*n+2*k+1));
+        s += t;
+      }
+      return s;
+    };
+    I[N-1] = series(N-1);
+    if (N > 1)
+      I[N-2] = series(N-2);
+    for (int n = N-2; n > 0; --n)
+      I[n-1] = I[n] + z2 * I[n+1] / ((2*n+1) * (2*n+3));
+  }
+
+  /** The scaled modified spherical Bessel functions of the second kind,
+   *   K[n] = k_n(z) (2/pi) z^{n+1} / (2n-1)!!,  0 <= n < N,
+   * by the upward recurrence K[n+1] = K[n] + z^2 K[n-1] / ((2n+1)(2n-1)).
+   */
+  static void bessel_k(real_type z, int N, real_type* K) {
+    K[0] = std::exp(-z);
+    if (N > 1)
+      K[1] = K[0] * (1 + z);
+    for (int n = 1; n+1 < N; ++n)
+      K[n+1] = K[n] + z*z * K[n-1] / ((2*n+1) * (2*n-1));
+  }
+
+ private:
+  //! The regular radial functions I_n(r) for n < N
+  void regular(real_type r, int N, real_type* f) const {
+    bessel_i(kappa * r, N, f);
+    real_type rn = 1;
+    for (int n = 0; n != N; ++n, rn *= r)
+      f[n] *= rn;
+  }
+  //! The singular radial functions K_n(r) for n < N
+  void singular(real_type r, int N, real_type* f) const {
+    bessel_k(kappa * r, N, f);
+    const real_type ir = 1 / r;
+    real_type rn = ir;
+    for (int n = 0; n != N; ++n, rn *= ir)
+      f[n] *= rn;
+  }
+
+  /** Rotate E into the frame of T, apply the coaxial matrix C, and rotate
+   * the result back into F */
+  template <typename Ein, typename Eout>
+  void translate(const translation_type& T, const real_type* C,
+                 bool transpose,
+                 const Ein& E, bool E_is_local,
+                 Eout& F, bool F_is_local) const {
+    const typename SphOp::RotationTable& R = SphOp::rotation_table(P);
+    complex_type X[P*(P+1)/2], Y[P*(P+1)/2];
+    SphOp::rotate_to_frame(R, T, P, E, 0, E_is_local, X);
+    translation_type::apply(P, C, X, Y, transpose);
+    SphOp::rotate_from_frame(R, T, P, Y, F_is_local, F, 0);
+  }
+};
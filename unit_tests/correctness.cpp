@@ -13,6 +13,7 @@ int main(int argc, char **argv)
 {
   int N = 10000;
   bool checkErrors = true;
+  bool sparse = false;
 
   // Parse custom command line args
   for (int i = 1; i < argc; ++i) {
@@ -20,6 +21,8 @@ int main(int argc, char **argv)
       N = atoi(argv[++i]);
     } else if (strcmp(argv[i],"-nocheck") == 0) {
       checkErrors = false;
+    } else if (strcmp(argv[i],"-sparse") == 0) {
+      sparse = true;
     }
   }
 
@@ -39,6 +42,12 @@ int main(int argc, char **argv)
   std::vector<source_type> points = fmmtl::random_n(N);
   std::vector<charge_type> charges = fmmtl::random_n(N);
 
+  // Zero the charges of most of the domain so whole boxes carry no charge
+  if (sparse)
+    for (unsigned k = 0; k < points.size(); ++k)
+      if (points[k][0] > 0.25)
+        charges[k] = 0;
+
   // Build the FMM
   //fmmtl::kernel_matrix<kernel_type> A = fmmtl::make_matrix(K, points);
   fmmtl::kernel_matrix<kernel_type> A = K(points, points);
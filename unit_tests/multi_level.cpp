@@ -6,7 +6,7 @@
 #include "LaplaceSpherical.hpp"
 //#include "LaplaceCartesian.hpp"
 #include "YukawaCartesian.hpp"
-//#include "StokesSpherical.hpp"
+#include "StokesSpherical.hpp"
 
 #include <iostream>
 
@@ -93,7 +93,7 @@ void two_level_test(const Expansion& K) {
 int main() {
   LaplaceSpherical K(5);
   //YukawaCartesian K(10, 0.1);
-  //StokesSpherical K(5);
 
   two_level_test(K);
+  two_level_test(StokesSpherical(5));
 }
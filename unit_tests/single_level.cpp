@@ -5,7 +5,7 @@
 
 #include "LaplaceSpherical.hpp"
 #include "YukawaCartesian.hpp"
-//#include "StokesSpherical.hpp"
+#include "StokesSpherical.hpp"
 
 #include <iostream>
 
@@ -72,7 +72,7 @@ void single_level_test(const Expansion& K) {
 int main() {
   LaplaceSpherical K(5);
   //YukawaCartesian K(10, 0.1);
-  //StokesSpherical K(5);
 
   single_level_test(K);
+  single_level_test(StokesSpherical(5));
 }
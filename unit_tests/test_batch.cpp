@@ -0,0 +1,208 @@
+/** @file test_batch.cpp
+ * @brief Compare the batch operators of the kernels against the sum of their
+ * scalar evaluations on random sources, charges, and targets.
+ */
+
+#include "Laplace.kern"
+#include "Yukawa.kern"
+#include "Helmholtz.kern"
+#include "Stokes.kern"
+#include "Gaussian.kern"
+#include "BiotSavart.kern"
+
+#include "fmmtl/meta/kernel_traits.hpp"
+#include "fmmtl/numeric/random.hpp"
+#include "fmmtl/util/SoA.hpp"
+#include "fmmtl/util/AlignedAllocator.hpp"
+
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <type_traits>
+
+/** The bodies of one batch test: n sources and charges with a target at
+ * a random point and a target on source 0, to check the self interaction
+ */
+template <class Kernel>
+struct BatchData {
+  typedef KernelTraits<Kernel> kernel_traits;
+  typedef typename kernel_traits::source_type source_type;
+  typedef typename kernel_traits::charge_type charge_type;
+  typedef typename kernel_traits::target_type target_type;
+  typedef typename kernel_traits::result_type result_type;
+
+  std::vector<source_type> s;
+  std::vector<charge_type> c;
+  std::vector<target_type> t;
+  //! The sum of the scalar evaluations for each target
+  std::vector<result_type> exact;
+  //! The sum of the magnitudes of the scalar terms for each target
+  std::vector<double> scale;
+
+  BatchData(const Kernel& K, unsigned n)
+      : s(n), c(n) {
+    for (unsigned k = 0; k < n; ++k) {
+      s[k] = fmmtl::random<source_type>::get();
+      c[k] = fmmtl::random<charge_type>::get();
+    }
+    t.push_back(fmmtl::random<target_type>::get());
+    t.push_back(s[0]);
+    for (auto&& ti : t) {
+      result_type r = result_type();
+      double m = 0;
+      for (unsigned k = 0; k < n; ++k) {
+        const result_type rk = K(ti, s[k]) * c[k];
+        r += rk;
+        m += norm_inf(rk);
+      }
+      exact.push_back(r);
+      scale.push_back(m);
+    }
+  }
+
+  /** The number of results of @a batch that differ from the scalar sums
+   * by more than @a tol relative to the magnitude of the terms */
+  template <class Batch>
+  int compare(Batch batch, double tol) const {
+    int wrong = 0;
+    for (unsigned i = 0; i < t.size(); ++i) {
+      result_type r = result_type();
+      batch(t[i], r);
+      if (norm_inf(r - exact[i]) > tol * scale[i])
+        ++wrong;
+    }
+    return wrong;
+  }
+};
+
+
+/** Padded SoA arrays of the values of a body type, as built by SoABind
+ * The padding repeats the last body with @a pad
+ */
+template <typename T, typename U, typename Iter>
+std::vector<T, fmmtl::aligned_allocator<T> >
+make_soa(Iter first, unsigned n, std::size_t np, const U& pad) {
+  typedef fmmtl::soa_traits<U> traits;
+  std::vector<T, fmmtl::aligned_allocator<T> > a(traits::components * np);
+  for (std::size_t k = 0; k < np; ++k)
+    for (std::size_t d = 0; d < traits::components; ++d)
+      a[d*np + k] = T(traits::get(k < n ? U(first[k]) : pad, d));
+  return a;
+}
+
+
+/** Compare the batch of contiguous sources against the scalar sums */
+template <class Kernel>
+int test_pointer_batch(const Kernel& K, const BatchData<Kernel>& b) {
+  typedef typename BatchData<Kernel>::target_type target_type;
+  typedef typename BatchData<Kernel>::result_type result_type;
+  const unsigned n = b.s.size();
+  return b.compare([&](const target_type& t, result_type& r) {
+      K.batch(t, b.s.data(), b.c.data(), n, r);
+    }, 1e-13);
+}
+
+/** Compare the batch of a padded SoA range against the scalar sums */
+template <class Kernel>
+typename std::enable_if<KernelTraits<Kernel>::has_soa_batch, int>::type
+test_soa_batch(const Kernel& K, const BatchData<Kernel>& b) {
+  typedef BatchData<Kernel> data;
+  typedef typename data::source_type source_type;
+  typedef typename data::charge_type charge_type;
+  typedef typename data::target_type target_type;
+  typedef typename data::result_type result_type;
+  typedef typename fmmtl::soa_traits<source_type>::value_type s_value;
+  typedef typename fmmtl::soa_traits<charge_type>::value_type c_value;
+
+  const unsigned n = b.s.size();
+  const std::size_t W = FMMTL_SIMD_WIDTH;
+  const std::size_t np = (n + W - 1) / W * W;
+  const auto s = make_soa<s_value>(b.s.begin(), n, np, b.s.back());
+  const auto q = make_soa<c_value>(b.c.begin(), n, np, charge_type(0));
+  const fmmtl::SoAView<source_type> s_view = {s.data(), np, np};
+  const fmmtl::SoAView<charge_type> q_view = {q.data(), np, np};
+  return b.compare([&](const target_type& t, result_type& r) {
+      K.batch(t, s_view, q_view, r);
+    }, 1e-13);
+}
+template <class Kernel>
+typename std::enable_if<!KernelTraits<Kernel>::has_soa_batch, int>::type
+test_soa_batch(const Kernel&, const BatchData<Kernel>&) {
+  return 0;
+}
+
+/** Compare the mixed-precision batch of float offsets from the target
+ * against the scalar sums, to float precision */
+template <class Kernel>
+typename std::enable_if<KernelTraits<Kernel>::has_mixed_batch, int>::type
+test_mixed_batch(const Kernel& K, const BatchData<Kernel>& b) {
+  typedef KernelTraits<Kernel> kernel_traits;
+  typedef typename kernel_traits::source_type       source_type;
+  typedef typename kernel_traits::charge_type       charge_type;
+  typedef typename kernel_traits::target_type       target_type;
+  typedef typename kernel_traits::result_type       result_type;
+  typedef typename kernel_traits::source_float_type source_float_type;
+  typedef typename kernel_traits::target_float_type target_float_type;
+  typedef typename kernel_traits::charge_float_type charge_float_type;
+
+  const unsigned n = b.s.size();
+  const std::size_t W = 2 * FMMTL_SIMD_WIDTH;
+  const std::size_t np = (n + W - 1) / W * W;
+  const auto q = make_soa<float>(b.c.begin(), n, np, charge_type(0));
+  const fmmtl::SoAView<charge_float_type> q_view = {q.data(), np, np};
+  return b.compare([&](const target_type& t, result_type& r) {
+      // The origin of the offsets is the target itself
+      std::vector<source_type> d(n);
+      for (unsigned k = 0; k < n; ++k)
+        d[k] = b.s[k] - t;
+      const auto s = make_soa<float>(d.begin(), n, np, d.back());
+      const fmmtl::SoAView<source_float_type> s_view = {s.data(), np, np};
+      K.batch(target_float_type(), s_view, q_view, r);
+    }, 1e-5);
+}
+template <class Kernel>
+typename std::enable_if<!KernelTraits<Kernel>::has_mixed_batch, int>::type
+test_mixed_batch(const Kernel&, const BatchData<Kernel>&) {
+  return 0;
+}
+
+
+/** Test each batch operator of K with ranges of sizes around the SIMD
+ * width and the tiles of the mixed-precision S2T */
+template <class Kernel>
+int test_batch(const Kernel& K, const char* name) {
+  static_assert(KernelTraits<Kernel>::has_batch, "Kernel has no batch");
+
+  int failed = 0;
+  for (unsigned n : {1, 3, 8, 37, 256, 1001}) {
+    const BatchData<Kernel> b(K, n);
+    const int p = test_pointer_batch(K, b);
+    const int s = test_soa_batch(K, b);
+    const int m = test_mixed_batch(K, b);
+    if (p || s || m)
+      std::cout << "  n = " << n << ": pointer " << p << ", SoA " << s
+                << ", mixed " << m << " wrong" << std::endl;
+    failed += p + s + m;
+  }
+  std::cout << name << " batch: " << failed << " wrong" << std::endl;
+  return failed;
+}
+
+
+int main() {
+  int failed = 0;
+
+  failed += test_batch(LaplacePotential(),   "LaplacePotential");
+  failed += test_batch(LaplaceKernel(),      "LaplaceKernel");
+  failed += test_batch(YukawaPotential(2),   "YukawaPotential");
+  failed += test_batch(YukawaKernel(2),      "YukawaKernel");
+  failed += test_batch(HelmholtzPotential(2), "HelmholtzPotential");
+  failed += test_batch(HelmholtzKernel(2),   "HelmholtzKernel");
+  failed += test_batch(Stokeslet(),          "Stokeslet");
+  failed += test_batch(BiotSavart(),         "BiotSavart");
+  failed += test_batch(Gaussian<1>(0.5),     "Gaussian<1>");
+  failed += test_batch(Gaussian<3>(0.5),     "Gaussian<3>");
+  failed += test_batch(Gaussian<4>(0.5),     "Gaussian<4>");
+
+  return failed != 0;
+}
@@ -2,6 +2,8 @@
 #include "fmmtl/Direct.hpp"
 
 #include <vector>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 
 struct TempKernel
@@ -57,6 +59,74 @@ struct TempKernel
 };
 
 
+struct DecayKernel
+    : public fmmtl::Kernel<DecayKernel> {
+  typedef double source_type;
+  typedef double charge_type;
+  typedef double target_type;
+  typedef double result_type;
+  typedef double kernel_value_type;
+
+  kernel_value_type operator()(const target_type& t,
+                               const source_type& s) const {
+    return 1.0 / (1.0 + std::abs(t - s));
+  }
+  kernel_value_type transpose(const kernel_value_type& kts) const {
+    return kts;
+  }
+};
+
+
+/** Compare the tiled direct matvecs against a naive double loop
+ * over sizes that are not multiples of the tile size, with 1 thread and
+ * with 4 threads and their per-thread accumulators
+ */
+int test_tiled(unsigned N) {
+  DecayKernel K;
+  std::vector<double> p(N), c(N);
+  for (unsigned i = 0; i < N; ++i) {
+    p[i] = drand48();
+    c[i] = drand48();
+  }
+
+  std::vector<double> exact(N, 0);
+  for (unsigned i = 0; i < N; ++i)
+    for (unsigned j = 0; j < N; ++j)
+      exact[i] += K(p[i],p[j]) * c[j];
+
+  const int max_threads = omp_get_max_threads();
+  int failed = 0;
+  for (int threads : {1, 4}) {
+    omp_set_num_threads(threads);
+
+    std::vector<double> asymm(N, 0), symm(N, 0), offd(N, 0);
+    fmmtl::direct(K, p, c, p, asymm);
+    fmmtl::direct(K, p, c, symm);
+    // The diagonal blocks of the first third and of the rest, and the
+    // off-diagonal block between them
+    const unsigned h = N / 3;
+    fmmtl::direct(K, p.begin(), p.begin() + h, c.begin(), offd.begin());
+    fmmtl::direct(K, p.begin() + h, p.end(), c.begin() + h,
+                  offd.begin() + h);
+    fmmtl::direct(K,
+                  p.begin(), p.begin() + h, c.begin(), offd.begin(),
+                  p.begin() + h, p.end(), c.begin() + h, offd.begin() + h);
+
+    int wrong = 0;
+    for (unsigned i = 0; i < N; ++i) {
+      const double tol = 1e-12 * std::abs(exact[i]);
+      if (std::abs(asymm[i] - exact[i]) > tol ||
+          std::abs(symm[i]  - exact[i]) > tol ||
+          std::abs(offd[i]  - exact[i]) > tol)
+        ++wrong;
+    }
+    std::cout << "N = " << N << ", " << threads << " threads: "
+              << wrong << " wrong" << std::endl;
+    failed += wrong;
+  }
+  omp_set_num_threads(max_threads);
+  return failed;
+}
 
 
 int main() {
@@ -85,4 +155,11 @@ int main() {
   std::cout << exact[0] << "\n";
   fmmtl::direct(K, sources, charges, exact);
   std::cout << exact[0] << "\n";
+
+  // test the tiled evaluation
+  int failed = 0;
+  failed += test_tiled(1);
+  failed += test_tiled(300);
+  failed += test_tiled(1000);
+  return failed != 0;
 }
@@ -0,0 +1,113 @@
+/** @file test_dynamic_mac.cpp
+ * @brief Test the evaluator of expansions with a dynamic MAC against the
+ * direct matvec, with 1 and with 4 threads.
+ */
+
+#include "fmmtl/KernelMatrix.hpp"
+#include "fmmtl/Direct.hpp"
+
+#include "ExpKernel.kern"
+
+#include <vector>
+#include <cmath>
+#include <iostream>
+
+/** The ExpExpansion with a MAC that depends on the multipoles. The
+ * expansions of the separable kernel are exact, so the result matches the
+ * direct matvec to round-off whichever box pairs are accepted, but each
+ * pair must be computed exactly once.
+ */
+struct DynamicExpExpansion
+    : public fmmtl::Expansion<ExpPotential, DynamicExpExpansion>
+{
+  typedef Vec<3,double> point_type;
+  typedef double multipole_type;
+  typedef double local_type;
+
+  //! Accept the multipoles below this value
+  double M_max;
+
+  DynamicExpExpansion(double _M_max) : M_max(_M_max) {}
+
+  /** Dynamic MAC: accept the source box if its multipole is small */
+  bool MAC(const multipole_type& M, const local_type&) const {
+    return std::abs(M) < M_max;
+  }
+
+  void S2M(const source_type& source, const charge_type& charge,
+           const point_type& center, multipole_type& M) const {
+    M += exp(center[0] + center[1] + center[2]
+             - source[0] - source[1] - source[2]) * charge;
+  }
+  void M2M(const multipole_type& source,
+                 multipole_type& target,
+           const point_type& translation) const {
+    target += exp(translation[0] + translation[1] + translation[2]) * source;
+  }
+  void M2L(const multipole_type& source,
+                 local_type& target,
+           const point_type& translation) const {
+    target += exp(translation[0] + translation[1] + translation[2]) * source;
+  }
+  void L2L(const local_type& source,
+                 local_type& target,
+           const point_type& translation) const {
+    target += exp(translation[0] + translation[1] + translation[2]) * source;
+  }
+  void L2T(const local_type& L, const point_type& center,
+           const target_type& target, result_type& result) const {
+    result += exp(target[0] + target[1] + target[2]
+                  - center[0] - center[1] - center[2]) * L;
+  }
+};
+
+
+/** Compare the FMM of K with the direct matvec, building the evaluator
+ * with 1 thread and with 4 threads
+ */
+int test_dynamic_mac(unsigned N, double M_max) {
+  typedef DynamicExpExpansion kernel_type;
+  typedef kernel_type::source_type source_type;
+  typedef kernel_type::charge_type charge_type;
+  typedef kernel_type::result_type result_type;
+
+  kernel_type K(M_max);
+  std::vector<source_type> points = fmmtl::random_n(N);
+  std::vector<charge_type> charges = fmmtl::random_n(N);
+
+  std::vector<result_type> exact(N, 0);
+  fmmtl::direct(K, points, charges, exact);
+
+  FMMOptions opts;
+  opts.ncrit = 32;
+
+  const int max_threads = omp_get_max_threads();
+  int failed = 0;
+  for (int threads : {1, 4}) {
+    omp_set_num_threads(threads);
+
+    fmmtl::kernel_matrix<kernel_type> A = K(points, points);
+    A.set_options(opts);
+    std::vector<result_type> result = A * charges;
+
+    int wrong = 0;
+    for (unsigned i = 0; i < N; ++i)
+      if (std::abs(result[i] - exact[i]) > 1e-12 * std::abs(exact[i]))
+        ++wrong;
+    std::cout << "N = " << N << ", M_max = " << M_max << ", "
+              << threads << " threads: " << wrong << " wrong" << std::endl;
+    failed += wrong;
+  }
+  omp_set_num_threads(max_threads);
+  return failed;
+}
+
+
+int main() {
+  int failed = 0;
+  // Accept no pair, some pairs, and every pair the geometric MAC accepts
+  failed += test_dynamic_mac(3000, 0);
+  failed += test_dynamic_mac(3000, 4);
+  failed += test_dynamic_mac(3000, 1e300);
+  return failed != 0;
+}
@@ -0,0 +1,192 @@
+/** Compare the operators of SphericalMultipole3D that compute the same
+ * expansions by different methods */
+
+#include "LaplaceSpherical.hpp"
+#include "BiotSpherical.hpp"
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+typedef LaplaceSpherical::SphOp          SphOp;
+typedef LaplaceSpherical::point_type     point_type;
+typedef LaplaceSpherical::complex_type   complex_type;
+typedef LaplaceSpherical::multipole_type expansion_type;
+
+
+/** The multipole of order P about the origin of random sources and
+ * charges in the ball of radius 1/2 */
+expansion_type random_multipole(int P) {
+  expansion_type M;
+  M.assign(P*(P+1)/2, complex_type(0));
+  for (int k = 0; k != 8; ++k) {
+    point_type s(drand48() - 0.5, drand48() - 0.5, drand48() - 0.5);
+    if (norm_2(s) < 0.5)
+      SphOp::S2M(P, -s, drand48() - 0.5, M);
+  }
+  return M;
+}
+
+/** The translation t with the data of both the direct and the rotation
+ * operators of order P */
+SphOp::Translation make_translation(int P, const point_type& t) {
+  SphOp::Translation T(std::max(P, int(SphOp::M2M_ROTATION_ORDER)), t);
+  double r, theta, phi;
+  SphOp::cart2sph(r, theta, phi, t);
+  T.Z.resize(P*(P+1)/2);
+  SphOp::evalZ(r, theta, phi, P, T.Z.data());
+  T.W.resize(P*(2*P+1));
+  SphOp::evalW(r, theta, phi, 2*P, T.W.data());
+  return T;
+}
+
+/** The number of coefficients of A that differ from B by more than
+ * round-off. The coefficients are compared as the normalized
+ *   N_n^m M_n^m / r^n   or   r^n L_n^m / N_n^m  if is_local
+ * with N_n^m = sqrt((n+m)!(n-m)!), which are at most about the total
+ * charge for sources within r of the center of a multipole, or at least r
+ * from the center of a local.
+ */
+int compare(int P, const expansion_type& A, const expansion_type& B,
+            bool is_local, double r) {
+  std::vector<double> w(P*(P+1)/2);
+  double scale = 0;
+  for (int n = 0; n != P; ++n) {
+    for (int m = 0; m <= n; ++m) {
+      const int nm = n*(n+1)/2 + m;
+      w[nm] = std::sqrt(std::tgamma(n+m+1.) * std::tgamma(n-m+1.))
+            / std::pow(r, n);
+      if (is_local)
+        w[nm] = 1 / w[nm];
+      scale = std::max(scale, w[nm] * std::abs(B[nm]));
+    }
+  }
+  int failed = 0;
+  for (int nm = 0; nm != P*(P+1)/2; ++nm)
+    if (w[nm] * std::abs(A[nm] - B[nm]) > 1e-13 * scale)
+      ++failed;
+  return failed;
+}
+
+/** Compare M2M_rotate, M2L_rotate, and L2L_rotate against the addition
+ * theorem for the orders P = 1..20 */
+int test_rotate(const point_type& dir) {
+  int failed = 0;
+  for (int P = 1; P <= 20; ++P) {
+    // The translations of M2M and L2L are shorter than those of M2L
+    const SphOp::Translation Tnear = make_translation(P, 0.4 * dir);
+    const SphOp::Translation Tfar  = make_translation(P, 3.0 * dir);
+
+    const expansion_type M = random_multipole(P);
+    expansion_type r, d;
+
+    // The local of the sources about the point at distance 3
+    expansion_type L;
+    L.assign(P*(P+1)/2, complex_type(0));
+    SphOp::M2L_direct(P, M, L, make_translation(P, point_type(2.4,0,1.8)));
+
+    r.assign(P*(P+1)/2, complex_type(0));
+    d.assign(P*(P+1)/2, complex_type(0));
+    SphOp::M2M_rotate(P, M, r, Tnear);
+    SphOp::M2M_direct(P, M, d, Tnear);
+    const int m2m = compare(P, r, d, false, 1);
+
+    r.assign(P*(P+1)/2, complex_type(0));
+    d.assign(P*(P+1)/2, complex_type(0));
+    SphOp::M2L_rotate(P, M, r, Tfar);
+    SphOp::M2L_direct(P, M, d, Tfar);
+    const int m2l = compare(P, r, d, true, 2);
+
+    r.assign(P*(P+1)/2, complex_type(0));
+    d.assign(P*(P+1)/2, complex_type(0));
+    SphOp::L2L_rotate(P, L, r, Tnear);
+    SphOp::L2L_direct(P, L, d, Tnear);
+    const int l2l = compare(P, r, d, true, 2);
+
+    if (m2m || m2l || l2l)
+      std::cout << "  P = " << P << ": M2M " << m2m << ", M2L " << m2l
+                << ", L2L " << l2l << " wrong" << std::endl;
+    failed += m2m + m2l + l2l;
+  }
+  std::cout << "Rotation along " << dir << ": " << failed << " wrong"
+            << std::endl;
+  return failed;
+}
+
+
+/** The local of order P of random sources at distance 3, in each complex
+ * component of the coefficients of Local */
+template <typename Local>
+Local random_local(int P) {
+  const int C = sizeof(typename Local::value_type) / sizeof(complex_type);
+  Local L;
+  L.assign(P*(P+1)/2, typename Local::value_type());
+  for (int c = 0; c != C; ++c) {
+    expansion_type Lc;
+    Lc.assign(P*(P+1)/2, complex_type(0));
+    SphOp::M2L_direct(P, random_multipole(P), Lc,
+                      make_translation(P, point_type(2.4, 0, 1.8)));
+    for (int nm = 0; nm != P*(P+1)/2; ++nm)
+      SphOp::component(L[nm], c) = Lc[nm];
+  }
+  return L;
+}
+
+/** Compare the vector L2T of K against its scalar L2T for the orders
+ * P = 1..16, with a full and a partial block of targets */
+template <typename Expansion>
+int test_L2T(const char* name) {
+  typedef typename Expansion::target_type target_type;
+  typedef typename Expansion::result_type result_type;
+  const int N = Expansion::SphOp::L2T_BLOCK + 3;
+
+  int failed = 0;
+  for (int P = 1; P <= 16; ++P) {
+    Expansion K(P);
+    const typename Expansion::local_type L =
+        random_local<typename Expansion::local_type>(P);
+    const point_type center(0.1, -0.2, 0.3);
+
+    std::vector<target_type> t(N);
+    for (int i = 0; i != N; ++i)
+      t[i] = center + point_type(drand48() - 0.5, drand48() - 0.5,
+                                 drand48() - 0.5);
+
+    std::vector<result_type> scalar(N, result_type(0));
+    std::vector<result_type> vector(N, result_type(0));
+    for (int i = 0; i != N; ++i)
+      K.L2T(L, center, t[i], scalar[i]);
+    K.L2T(L, center, t.begin(), t.end(), vector.begin());
+    // A partial block alone
+    std::vector<result_type> partial(3, result_type(0));
+    K.L2T(L, center, t.begin(), t.begin() + 3, partial.begin());
+
+    double scale = 0;
+    for (int i = 0; i != N; ++i)
+      scale = std::max(scale, norm_inf(scalar[i]));
+    for (int i = 0; i != N; ++i)
+      if (norm_inf(vector[i] - scalar[i]) > 1e-13 * scale ||
+          (i < 3 && norm_inf(partial[i] - scalar[i]) > 1e-13 * scale))
+        ++failed;
+  }
+  std::cout << name << " L2T: " << failed << " wrong" << std::endl;
+  return failed;
+}
+
+
+int main() {
+  int failed = 0;
+
+  // Along +z and -z, the axis of the rotations, and in the xy-plane
+  failed += test_rotate(point_type(0, 0, 1));
+  failed += test_rotate(point_type(0, 0, -1));
+  failed += test_rotate(point_type(1, 0, 0));
+  failed += test_rotate(point_type(-0.6, 0.8, 0));
+  failed += test_rotate(point_type(0.48, -0.6, 0.64));
+
+  failed += test_L2T<LaplaceSpherical>("LaplaceSpherical");
+  failed += test_L2T<BiotSpherical>("BiotSpherical");
+
+  return failed != 0;
+}